@@ -29,8 +29,25 @@ extern int profiling_state;
 extern bool checkpoint_taking;
 extern bool checkpoint_restoring;
 extern uint64_t checkpoint_interval;
+extern int checkpoint_jobs;
+extern int checkpoint_threads;
+extern int checkpoint_level;
+extern bool checkpoint_sparse;
+extern int checkpoint_delta;
+extern bool simpoint_binary;
 
 extern bool profiling_started;
 extern bool force_cpt_mmode;
 
+// Counters of SimPoint profiling, updated by the interpreter at the end of
+// each basic block. SimPoint is only called to assign the id of a block and
+// at the end of an interval.
+typedef struct {
+  uint64_t *bb_count;     // dynamic instructions of each block in the interval, indexed by id
+  uint64_t last_icount;   // instruction count at the end of the previous block
+  uint64_t interval_end;  // instruction count at which the interval ends
+} SimpointCounters;
+
+extern SimpointCounters simpoint_counters;
+
 #endif
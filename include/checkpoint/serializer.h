@@ -34,6 +34,13 @@ class Serializer
 
     void serializeRegs();
 
+    void compressPMemParallel(const std::string &filepath, const uint8_t *pmem, size_t size);
+
+    void serializePMemSparse(const std::string &filepath, const uint8_t *pmem, size_t size,
+                             const std::string &parent);
+
+    std::string pmemFilePath(uint64_t inst_count);
+
     explicit Serializer();
 
     void init();
@@ -42,6 +49,8 @@ class Serializer
 
     void notify_taken(uint64_t i);
 
+    void waitWorkers(unsigned max_in_flight);
+
   private:
 
     uint64_t intervalSize{10 * 1000 * 1000};
@@ -60,6 +69,13 @@ class Serializer
     std::map<uint64_t, double> simpoint2Weights;
 
     uint64_t nextUniformPoint;
+
+    // forked processes still serializing checkpoints, see --cpt-jobs
+    unsigned workersInFlight{0};
+
+    // the checkpoint the next one is a delta on, empty for a full one, see --cpt-delta
+    std::string deltaParent;
+    int nrDelta{0};
 };
 
 extern Serializer serializer;
@@ -42,6 +42,7 @@
 #define __CPU_SIMPLE_PROBES_SIMPOINT_HH__
 
 #include <unordered_map>
+#include <vector>
 #include <base/output.h>
 
 namespace SimPointNS {
@@ -68,7 +69,9 @@ struct hash<BasicBlockRange>
 {
   public:
     size_t operator()(const BasicBlockRange &bb) const {
-      return hash<Addr>()(bb.first + bb.second);
+      // the sum is the same for all blocks of a given length ending at the
+      // same distance, mix the bits of both ends instead
+      return hash<Addr>()((bb.first * 0x9e3779b97f4a7c15ull) ^ bb.second);
     }
 };
 }
@@ -93,7 +96,25 @@ class SimPoint
 
     void profile_with_abs_icount(Addr pc, bool is_control, bool is_last_uop, uint64_t abs_icount);
 
+    /**
+     * Id of the basic block entered at pc, which is cached in the slot of
+     * the trace cache entry at pc. The interpreter counts the instructions
+     * of the block in simpoint_counters.
+     */
+    uint32_t profile_bb_id(uint32_t *id_slot, Addr pc, uint64_t insts);
+
+    /** End the interval counted in simpoint_counters */
+    void profile_interval_end();
+
   private:
+    /** Id of a basic block, which is inserted if never seen before */
+    uint32_t lookup(const BasicBlockRange &bb, uint64_t insts);
+
+    void count(uint32_t id, uint64_t insts);
+
+    /** Write the BBV of the interval just finished and reset the counts */
+    void dumpInterval();
+
     uint64_t lastICount{0};
     /** SimPoint profiling interval size in instructions */
     uint64_t intervalSize;
@@ -105,6 +126,14 @@ class SimPoint
     /** Pointer to SimPoint BBV output stream */
     NEMUNS::OutputStream *simpointStream;
 
+    /**
+     * With --simpoint-bin, each interval is written to simpoint_bbv.bin.gz
+     * as a little-endian uint32_t number of blocks, followed by that many
+     * packed records of uint32_t id and uint64_t count, sorted by id.
+     * scripts/bbv2text.py converts it to the text format.
+     */
+    bool binaryOutput{false};
+
     /** Basic Block information */
     struct BBInfo
     {
@@ -112,12 +141,15 @@ class SimPoint
         uint64_t id;
         /** Num of static insts in BB */
         uint64_t insts;
-        /** Accumulated dynamic inst count executed by BB */
-        uint64_t count;
     };
 
     /** Hash table containing all previously seen basic blocks */
     ::std::unordered_map<BasicBlockRange, BBInfo> bbMap;
+    /**
+     * Dynamic inst count executed by each BB in the interval, indexed by id,
+     * also referred to by simpoint_counters.bb_count
+     */
+    ::std::vector<uint64_t> bbCount;
     /** Currently executing basic block */
     BasicBlockRange currentBBV;
     /** inst count in current basic block */
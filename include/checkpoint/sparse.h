@@ -0,0 +1,46 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CHECKPOINT_SPARSE_H__
+#define __CHECKPOINT_SPARSE_H__
+
+#include <stdint.h>
+
+// Layout of a sparse pmem checkpoint (*.sparse):
+//   SparseCptHeader
+//   bitmap of nr_page bits, one uint64_t per 64 pages, set for non-zero pages
+//   padding up to data_offset
+//   the non-zero pages in ascending order, page i at
+//     data_offset + (number of set bits before i) * page_size
+// Pages are stored raw and page-aligned, so they can be read straight into
+// pmem. Zero pages are not stored at all.
+//
+// A delta checkpoint has SPARSE_DELTA_MAGIC and the same layout, but its
+// bitmap marks the pages written since its parent checkpoint, zero or not,
+// and the NUL-terminated path of the parent follows the bitmap. Its memory
+// is the one of the parent, recursively, with the stored pages applied.
+
+#define SPARSE_CPT_MAGIC   0x53525053554d454eull // "NEMUSPRS"
+#define SPARSE_DELTA_MAGIC 0x41544c44554d454eull // "NEMUDLTA"
+
+typedef struct {
+  uint64_t magic;
+  uint64_t page_size;
+  uint64_t nr_page;
+  uint64_t nr_present;
+  uint64_t data_offset;
+} SparseCptHeader;
+
+#endif
@@ -39,6 +39,9 @@ typedef MUXDEF(PMEM64, uint64_t, uint32_t) paddr_t;
 #define FMT_PADDR MUXDEF(PMEM64, "0x%016lx", "0x%08x")
 typedef uint16_t ioaddr_t;
 
+// state of the hart running on the calling host thread
+#define HART_LOCAL MUXDEF(CONFIG_MULTIHART, __thread, )
+
 #define CP printf("%s: %d\n", __FILE__, __LINE__);fflush( stdout );
 struct DynamicConfig {
   bool ignore_illegal_mem_access;
@@ -32,12 +32,15 @@ __attribute__((noreturn)) void longjmp_exception(int ex_cause);
 enum {
   SYS_STATE_UPDATE = 1,
   SYS_STATE_FLUSH_TCACHE = 2,
+  SYS_STATE_FLUSH_CODE = 4, // only the code written since the last fence.i
 };
 void set_sys_state_flag(int flag);
 void mmu_tlb_flush(vaddr_t vaddr);
+void mmu_tlb_flush_asid(vaddr_t vaddr, word_t asid);
 
 struct Decode;
 void save_globals(struct Decode *s);
-void fetch_decode(struct Decode *s, vaddr_t pc);
+int fetch_decode(struct Decode *s, vaddr_t pc);
+bool fuse_decode(struct Decode *prev, int prev_idx, struct Decode *s, int *idx);
 
 #endif
@@ -0,0 +1,67 @@
+/***************************************************************************************
+* Copyright (c) 2014-2021 Zihao Yu, Nanjing University
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_DBT_H__
+#define __CPU_DBT_H__
+
+#include <cpu/decode.h>
+
+// Runs of instructions inside hot basic blocks are translated into host
+// code. The EHelper of the first instruction of a block being profiled is
+// replaced by exec_nemu_dbt_profile, and that of a run by exec_nemu_dbt.
+// The host code returns the first instruction left to the interpreter.
+typedef Decode* (*DBTCode)(CPU_state *cpu, Decode *s);
+
+static inline Decode* dbt_exec(Decode *s) {
+  return ((DBTCode)s->native)(&cpu, s);
+}
+
+void dbt_init(const void *exec_nemu_dbt, const void *exec_nemu_dbt_profile,
+    const void **exec_table, int nr_exec);
+// start profiling a newly decoded basic block
+void dbt_bb_new(Decode *head);
+// count an execution of the block at `s`, return the EHelper to go on with
+const void* dbt_profile(Decode *s);
+void dbt_translate(Decode *head);
+void dbt_restore(Decode *s);
+void dbt_flush();
+void dbt_statistic();
+
+// operations of dbt_alu() and dbt_alui()
+enum {
+  DBT_ADD, DBT_SUB, DBT_AND, DBT_OR, DBT_XOR, DBT_SHL, DBT_SHR, DBT_SAR, DBT_MUL,
+  DBT_ADDW, DBT_SUBW, DBT_SHLW, DBT_SHRW, DBT_SARW, DBT_MULW,
+};
+
+// Host code emitters for the RTL instructions, used by isa_dbt_translate()
+void dbt_alu(int op, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2);
+void dbt_alui(int op, rtlreg_t *dest, const rtlreg_t *src1, sword_t imm);
+void dbt_setrelop(uint32_t relop, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2);
+void dbt_setrelopi(uint32_t relop, rtlreg_t *dest, const rtlreg_t *src1, sword_t imm);
+void dbt_li(rtlreg_t *dest, rtlreg_t imm);
+void dbt_lm(Decode *s, rtlreg_t *dest, const rtlreg_t *addr, word_t offset, int len, int mmu_mode, bool sign);
+void dbt_sm(Decode *s, const rtlreg_t *src1, const rtlreg_t *addr, word_t offset, int len, int mmu_mode);
+// a branch inside a superblock, which leaves the host code at `s` when it
+// does not go the inlined direction
+void dbt_jrelop(Decode *s, uint32_t relop, const rtlreg_t *src1, const rtlreg_t *src2);
+// call the EHelper of `s` compiled as a function
+void dbt_call(Decode *s, void (*ehelper)(Decode *));
+
+// Emit host code for `s` executed by the EHelper `idx`. Return false
+// without emitting anything if `s` is left to the interpreter.
+bool isa_dbt_translate(Decode *s, int idx);
+
+#endif
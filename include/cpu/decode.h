@@ -44,48 +44,83 @@ enum {
   INSTR_TYPE_I, // indirect
 };
 
+// which direction of a jump or branch stays inside the superblock
+enum { TRACE_DIR_NONE, TRACE_DIR_NTAKEN, TRACE_DIR_TAKEN };
+
+// how a jump uses the return address stack
+enum { RAS_NONE, RAS_PUSH, RAS_POP };
+
 enum {
   CFI_NONE,   //not cfi
   CFI_BRANCH, //branch 
   CFI_JUMP,   //jump
 };
 
+#ifdef CONFIG_PERF_OPT
+// targets of an indirect jump besides tnext, in MRU order
+typedef struct {
+  struct Decode *way[CONFIG_TCACHE_JR_WAYS - 1];
+  IFDEF(CONFIG_TCACHE_RAS, struct Decode *rnext); // the basic block returned to, for a call
+#ifdef CONFIG_TCACHE_JR_STAT
+  uint64_t hit, ras_hit, miss;
+#endif
+} JRCache;
+#endif
+
+// The fields read by execute() come first. With CONFIG_PERF_OPT, an entry
+// takes 64 bytes, so the trace cache holds one per cache line: ntnext shares
+// its space with what the other types of instructions need, and the
+// sequential next pc is computed from the instruction length. These 64 bytes
+// are full, so CONFIG_TCACHE_TRACE or CONFIG_RV_DASICS, or both, make it 72.
 typedef struct Decode {
+  IFDEF (CONFIG_PERF_OPT, const void *EHelper);
+  IFNDEF(CONFIG_PERF_OPT, void (*EHelper)(struct Decode *));
+  Operand dest, src1, src2;
+  union {
+    struct Decode *tnext;     // next pointer for taken branch and jump
+    struct Decode *list_next; // next pointer for list, only used by tcache_tmp_pool
+  };
   union {
-    struct {
-      struct Decode *tnext;  // next pointer for taken branch and jump
-      struct Decode *ntnext; // next pointer for non-taken branch
-    };
-    struct {  // only used by tcache_tmp_pool
-      struct Decode *list_next; // next pointer for list
-      struct Decode *bb_src;    // pointer recording the source of basic block direction
-    };
+    struct Decode *ntnext;  // next pointer for non-taken branch, or the return of a direct call
+    struct Decode *bb_src;  // pointer recording the source of basic block direction, only used by tcache_tmp_pool
+    IFDEF(CONFIG_PERF_OPT, JRCache *jrc); // indirect jump
+    IFDEF(CONFIG_ENGINE_DBT, const void *native); // host code translated from here, only for INSTR_TYPE_N
   };
   vaddr_t pc;
-  vaddr_t snpc; // sequential next pc
+  uint16_t idx_in_bb; // the number of instruction in the basic block, start from 1
+  uint8_t type : 2;
+  IFDEF(CONFIG_TCACHE_RAS, uint8_t ras_op : 2);
+  IFDEF(CONFIG_TCACHE_TRACE, uint8_t trace_dir : 2);
+  uint8_t ilen; // length of the instruction in bytes
+  ISADecodeInfo isa;
+#ifdef CONFIG_TCACHE_TRACE
+  uint16_t trace_cnt;   // executions of a block-ending branch, saturated at CONFIG_TCACHE_TRACE_HOT
+  uint16_t trace_taken;
+#endif
   #ifdef CONFIG_RV_DASICS
+  #ifndef CONFIG_PERF_OPT
   vaddr_t prev_pc;  // previous pc for branch check
   uint8_t prev_type;  // branch or jump
   uint8_t prev_is_cfi;  //previous instruction is a control flow instruction
-  #endif 
-  IFDEF (CONFIG_PERF_OPT, const void *EHelper);
-  IFNDEF(CONFIG_PERF_OPT, void (*EHelper)(struct Decode *));
-  Operand dest, src1, src2;
-  vaddr_t jnpc;
-  uint16_t idx_in_bb; // the number of instruction in the basic block, start from 1
-  uint8_t type;
-  ISADecodeInfo isa;
+  #endif
+  // zone of pc in bits 1:0, and with CONFIG_PERF_OPT, whether the transfers
+  // along tnext/ntnext are allowed in bits 2/3, tagged with the privilege
+  // mode and DASICS CSRs in the bits above, see dasics_zone_cached()
+  uint32_t dasics_tag;
+  #endif
   IFDEF(CONFIG_DEBUG, char logbuf[80]);
   #ifdef CONFIG_RVV
   // for vector
   int v_width;
   uint32_t vm;
   uint32_t src_vmode;
-  rtlreg_t tmp_reg[4];
   #endif // CONFIG_RVV
 
 } Decode;
 
+// sequential next pc
+static inline vaddr_t decode_snpc(Decode *s) { return s->pc + s->ilen; }
+
 
 #define id_src1 (&s->src1)
 #define id_src2 (&s->src2)
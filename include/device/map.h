@@ -47,10 +47,16 @@ static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
 
 void add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
+// A map without callback is plain memory. Pages entirely inside it may be
+// accessed directly through the host TLB, see mmio_plain_page().
 void add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
+#ifdef CONFIG_MULTIHART
+void device_lock();
+void device_unlock();
+#endif
 
 #endif
@@ -28,16 +28,23 @@ typedef concat(__ISA__, _ISADecodeInfo) ISADecodeInfo;
 // monitor
 extern char isa_logo[];
 void init_isa();
+#ifdef CONFIG_MULTIHART
+void isa_init_hart(int id); // reset the hart running on the calling thread
+#endif
 
 // reg
-extern CPU_state cpu;
-extern rtlreg_t csr_array[4096];
+extern HART_LOCAL CPU_state cpu;
+extern HART_LOCAL rtlreg_t csr_array[4096];
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
 
 // exec
 struct Decode;
 int isa_fetch_decode(struct Decode *s);
+bool isa_fuse(struct Decode *prev, int *prev_idx, struct Decode *s, int *idx);
+#ifndef isa_jnpc
+vaddr_t isa_jnpc(struct Decode *s); // target of a direct jump or branch
+#endif
 void isa_hostcall(uint32_t id, rtlreg_t *dest, const rtlreg_t *src1,
     const rtlreg_t *src2, word_t imm, vaddr_t pc);
 
@@ -58,6 +65,9 @@ bool isa_pmp_check_permission(paddr_t addr, int len, int type, int mode);
 vaddr_t raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
 word_t isa_query_intr();
+#ifdef CONFIG_MULTIHART
+void isa_poll_intr(); // pick up interrupts posted by other harts and the timer
+#endif
 
 // difftest
   // for dut
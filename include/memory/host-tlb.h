@@ -21,7 +21,17 @@
 struct Decode;
 word_t hosttlb_read(struct Decode *s, vaddr_t vaddr, int len, int type);
 void hosttlb_write(struct Decode *s, vaddr_t vaddr, int len, word_t data);
+word_t hosttlb_ifetch(vaddr_t vaddr, int len);
 void hosttlb_init();
 void hosttlb_flush(vaddr_t vaddr);
+void hosttlb_flush_asid(vaddr_t vaddr, word_t asid);
+void hosttlb_set_context(word_t asid, word_t root, int data_priv, int ifetch_priv);
+void hosttlb_statistic();
+void hosttlb_flush_write(paddr_t paddr);
+void hosttlb_flush_write_all();
+paddr_t hosttlb_ifetch_paddr(vaddr_t vaddr);
+void* hosttlb_atomic_addr(struct Decode *s, vaddr_t vaddr, int len);
+bool hosttlb_dasics_allowed(vaddr_t vaddr, int len, int type);
+void hosttlb_dasics_flush();
 
 #endif
@@ -53,6 +53,22 @@ word_t paddr_read(paddr_t addr, int len, int type, int mode, vaddr_t vaddr);
 void paddr_write(paddr_t addr, int len, word_t data, int mode, vaddr_t vaddr);
 uint8_t *get_pmem();
 
+#ifdef CONFIG_TCACHE_SMC
+// track pmem pages holding decoded instructions to detect self-modifying code
+bool pmem_code_map_write(paddr_t addr);
+void pmem_code_mark(paddr_t addr);
+void pmem_code_write(paddr_t addr, size_t len);
+bool pmem_code_dirty(paddr_t addr);
+bool pmem_code_has_dirty();
+void pmem_code_clean();
+#endif
+
+// track pmem pages written since the last checkpoint for delta checkpoints
+void pmem_dirty_init();
+void pmem_dirty_write(paddr_t addr, size_t len);
+const uint64_t* pmem_dirty_bitmap();
+void pmem_dirty_clean();
+
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
 
 #define STORE_QUEUE_SIZE 64
@@ -0,0 +1,47 @@
+#***************************************************************************************
+# Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+#!/usr/bin/env python3
+
+# Convert a binary SimPoint BBV (--simpoint-bin) into the text format read by
+# SimPoint, with one "T:id:count ..." line per interval. The layout is
+# described in include/checkpoint/simpoint.h.
+#
+# usage: bbv2text.py simpoint_bbv.bin.gz [simpoint_bbv.gz]
+
+import gzip
+import struct
+import sys
+
+NR = struct.Struct('<I')
+RECORD = struct.Struct('<IQ')
+
+def main():
+  if len(sys.argv) not in (2, 3):
+    sys.exit(f'usage: {sys.argv[0]} BBV.bin.gz [OUTPUT.gz]')
+  out = gzip.open(sys.argv[2], 'wt') if len(sys.argv) == 3 else sys.stdout
+  with gzip.open(sys.argv[1], 'rb') as f:
+    while True:
+      buf = f.read(NR.size)
+      if not buf:
+        break
+      nr, = NR.unpack(buf)
+      buf = f.read(RECORD.size * nr)
+      assert len(buf) == RECORD.size * nr, f'{sys.argv[1]} is truncated'
+      out.write('T' + ''.join(f':{id}:{count} ' for id, count in RECORD.iter_unpack(buf)) + '\n')
+  out.close()
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,66 @@
+#***************************************************************************************
+# Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+#!/usr/bin/env python3
+
+# Turn a delta checkpoint (--cpt-delta) into a full sparse checkpoint which
+# does not depend on its parents. The layout is described in
+# include/checkpoint/sparse.h.
+#
+# usage: materialize_cpt.py DELTA.sparse OUTPUT.sparse
+
+import struct
+import sys
+
+SPARSE_CPT_MAGIC   = 0x53525053554d454e
+SPARSE_DELTA_MAGIC = 0x41544c44554d454e
+HEADER = struct.Struct('<5Q')
+
+def load(path, pages):
+  with open(path, 'rb') as f:
+    magic, page_size, nr_page, nr_present, data_offset = HEADER.unpack(f.read(HEADER.size))
+    assert magic in (SPARSE_CPT_MAGIC, SPARSE_DELTA_MAGIC), f'{path} is not a sparse checkpoint'
+    bitmap = f.read((nr_page + 63) // 64 * 8)
+    if magic == SPARSE_DELTA_MAGIC:
+      parent = f.read(data_offset - f.tell()).split(b'\0')[0].decode()
+      load(parent, pages)
+    f.seek(data_offset)
+    for i in range(nr_page):
+      if (bitmap[i // 8] >> (i % 8)) & 1:
+        pages[i] = f.read(page_size)
+  return page_size, nr_page
+
+def main():
+  if len(sys.argv) != 3:
+    sys.exit(f'usage: {sys.argv[0]} DELTA.sparse OUTPUT.sparse')
+  pages = {}
+  page_size, nr_page = load(sys.argv[1], pages)
+  zero = bytes(page_size)
+  present = sorted(i for i in pages if i < nr_page and pages[i] != zero)
+
+  bitmap = bytearray((nr_page + 63) // 64 * 8)
+  for i in present:
+    bitmap[i // 8] |= 1 << (i % 8)
+  data_offset = (HEADER.size + len(bitmap) + page_size - 1) // page_size * page_size
+
+  with open(sys.argv[2], 'wb') as f:
+    f.write(HEADER.pack(SPARSE_CPT_MAGIC, page_size, nr_page, len(present), data_offset))
+    f.write(bitmap)
+    f.write(bytes(data_offset - f.tell()))
+    for i in present:
+      f.write(pages[i])
+
+if __name__ == '__main__':
+  main()
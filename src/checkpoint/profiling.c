@@ -14,16 +14,27 @@
 ***************************************************************************************/
 
 #include <checkpoint/profiling.h>
+#include <zlib.h>
 
 int profiling_state = NoProfiling;
 bool checkpoint_taking = false;
 bool checkpoint_restoring = false;
 uint64_t checkpoint_interval = 0;
+int checkpoint_jobs = 0;
+int checkpoint_threads = 1;
+int checkpoint_level = Z_DEFAULT_COMPRESSION;
+bool checkpoint_sparse = false;
+int checkpoint_delta = 0;
+bool simpoint_binary = false;
 
 bool profiling_started = false;
 bool force_cpt_mmode = false;
 
+SimpointCounters simpoint_counters = {};
+
 #ifdef CONFIG_SHARE
 // empty definition on share
 void simpoint_profiling(uint64_t pc, bool is_control, uint64_t abs_instr_count) {}
+uint32_t simpoint_bb_id(uint32_t *id_slot, uint64_t pc, uint64_t insts) { return 0; }
+void simpoint_interval_end() {}
 #endif 
\ No newline at end of file
@@ -21,6 +21,7 @@
 #include <checkpoint/profiling.h>
 #include <checkpoint/serializer.h>
 #include <checkpoint/cpt_env.h>
+#include <checkpoint/sparse.h>
 
 #include "../isa/riscv64/local-include/csr.h"
 
@@ -33,8 +34,13 @@
 #include <limits>
 #include <string>
 
+#include <filesystem>
 #include <fstream>
+#include <thread>
+#include <vector>
 #include <gcpt_restore/src/restore_rom_addr.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using std::cout;
 using std::cerr;
@@ -61,6 +67,143 @@ uint8_t* guest_to_host(paddr_t paddr);
 #include <debug.h>
 extern bool log_enable();
 extern unsigned long MEMORY_SIZE;
+void wait_cpt_workers();
+#include <memory/vaddr.h>
+void pmem_dirty_init();
+void pmem_dirty_write(paddr_t addr, size_t len);
+const uint64_t* pmem_dirty_bitmap();
+void pmem_dirty_clean();
+}
+
+// Compress len bytes at src into a standalone gzip member.
+static void compressChunk(const uint8_t *src, size_t len, std::vector<uint8_t> &out) {
+  z_stream zs = {};
+  int ret = deflateInit2(&zs, checkpoint_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  assert(ret == Z_OK);
+  out.resize(deflateBound(&zs, len));
+  zs.next_in = (Bytef *)src;
+  zs.avail_in = len;
+  zs.next_out = out.data();
+  zs.avail_out = out.size();
+  ret = deflate(&zs, Z_FINISH);
+  assert(ret == Z_STREAM_END);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+}
+
+// pmem is cut into chunks compressed by checkpoint_threads threads, pigz
+// style. Each chunk is a gzip member of its own, and gzread() transparently
+// reads the concatenated members, so the file is still restored by
+// load_gz_img(). Chunks are compressed in rounds of one per thread to
+// bound the memory holding the compressed data.
+void Serializer::compressPMemParallel(const string &filepath, const uint8_t *pmem, size_t size) {
+  const size_t CHUNK_SIZE = 64 * 1024 * 1024;
+  FILE *fp = fopen(filepath.c_str(), "wb");
+  if (fp == nullptr) {
+    cerr << "Failed to open " << filepath << endl;
+    xpanic("Can't open physical memory checkpoint file!\n");
+  } else {
+    cout << "Opening " << filepath << " as checkpoint output file with "
+         << checkpoint_threads << " compression threads" << endl;
+  }
+
+  size_t nr_chunk = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  std::vector<std::vector<uint8_t>> out(checkpoint_threads);
+  for (size_t round = 0; round < nr_chunk; round += checkpoint_threads) {
+    size_t nr_thread = std::min((size_t)checkpoint_threads, nr_chunk - round);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nr_thread; i++) {
+      size_t offset = (round + i) * CHUNK_SIZE;
+      size_t len = std::min(CHUNK_SIZE, size - offset);
+      threads.emplace_back(compressChunk, pmem + offset, len, std::ref(out[i]));
+    }
+    for (size_t i = 0; i < nr_thread; i++) {
+      threads[i].join();
+      if (fwrite(out[i].data(), 1, out[i].size(), fp) != out[i].size()) {
+        xpanic("Write failed on physical memory checkpoint file\n");
+      }
+    }
+    Log("Written 0x%lx bytes\n", std::min(size, (round + nr_thread) * CHUNK_SIZE));
+  }
+
+  if (fclose(fp)) {
+    xpanic("Close failed on physical memory checkpoint file\n");
+  }
+}
+
+static bool page_is_zero(const uint8_t *page) {
+  auto *p = (const uint64_t *)page;
+  for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+    if (p[i] != 0) return false;
+  }
+  return true;
+}
+
+// See checkpoint/sparse.h for the layout. With a parent, only the pages
+// written since the parent was taken are stored.
+void Serializer::serializePMemSparse(const string &filepath, const uint8_t *pmem, size_t size,
+    const string &parent) {
+  FILE *fp = fopen(filepath.c_str(), "wb");
+  if (fp == nullptr) {
+    cerr << "Failed to open " << filepath << endl;
+    xpanic("Can't open physical memory checkpoint file!\n");
+  } else {
+    cout << "Opening " << filepath << " as sparse checkpoint output file" << endl;
+  }
+
+  bool delta = !parent.empty();
+  SparseCptHeader hdr = {};
+  hdr.magic = delta ? SPARSE_DELTA_MAGIC : SPARSE_CPT_MAGIC;
+  hdr.page_size = PAGE_SIZE;
+  hdr.nr_page = size / PAGE_SIZE;
+  std::vector<uint64_t> bitmap((hdr.nr_page + 63) / 64);
+  const uint64_t *dirty = pmem_dirty_bitmap();
+  for (uint64_t i = 0; i < hdr.nr_page; i++) {
+    bool present = delta ? (dirty[i / 64] >> (i % 64)) & 1 : !page_is_zero(pmem + i * PAGE_SIZE);
+    if (present) {
+      bitmap[i / 64] |= 1ull << (i % 64);
+      hdr.nr_present++;
+    }
+  }
+  size_t bitmap_size = bitmap.size() * sizeof(uint64_t);
+  size_t parent_size = delta ? parent.size() + 1 : 0;
+  hdr.data_offset = (sizeof(hdr) + bitmap_size + parent_size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+  std::vector<uint8_t> padding(hdr.data_offset - sizeof(hdr) - bitmap_size - parent_size);
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+      fwrite(bitmap.data(), 1, bitmap_size, fp) != bitmap_size ||
+      fwrite(parent.c_str(), 1, parent_size, fp) != parent_size ||
+      fwrite(padding.data(), 1, padding.size(), fp) != padding.size()) {
+    xpanic("Write failed on physical memory checkpoint file\n");
+  }
+  for (uint64_t i = 0; i < hdr.nr_page; i++) {
+    if ((bitmap[i / 64] >> (i % 64)) & 1) {
+      if (fwrite(pmem + i * PAGE_SIZE, PAGE_SIZE, 1, fp) != 1) {
+        xpanic("Write failed on physical memory checkpoint file\n");
+      }
+    }
+  }
+  if (delta) {
+    Log("Written %lu pages of %lu changed since %s\n", hdr.nr_present, hdr.nr_page, parent.c_str());
+  } else {
+    Log("Written %lu non-zero pages of %lu\n", hdr.nr_present, hdr.nr_page);
+  }
+
+  if (fclose(fp)) {
+    xpanic("Close failed on physical memory checkpoint file\n");
+  }
+}
+
+string Serializer::pmemFilePath(uint64_t inst_count) {
+  string suffix = checkpoint_sparse ? "_.sparse" : "_.gz";
+  if (profiling_state == SimpointCheckpointing) {
+      return pathManager.getOutputPath() + "_" + \
+                        to_string(simpoint2Weights.begin()->first) + "_" + \
+                        to_string(simpoint2Weights.begin()->second) + suffix;
+  } else {
+      return pathManager.getOutputPath() + "_" + \
+                        to_string(inst_count) + suffix;
+  }
 }
 
 void Serializer::serializePMem(uint64_t inst_count) {
@@ -80,17 +223,29 @@ void Serializer::serializePMem(uint64_t inst_count) {
   fclose(fp);
   Log("Put gcpt restorer %s to start of pmem", restorer);
 
-  string filepath;
-  if (profiling_state == SimpointCheckpointing) {
-      filepath = pathManager.getOutputPath() + "_" + \
-                        to_string(simpoint2Weights.begin()->first) + "_" + \
-                        to_string(simpoint2Weights.begin()->second) + "_.gz";
-  } else {
-      filepath = pathManager.getOutputPath() + "_" + \
-                        to_string(inst_count) + "_.gz";
+  string filepath = pmemFilePath(inst_count);
+
+  if (checkpoint_sparse) {
+    // the restorer and the registers written above are part of the delta
+    pmem_dirty_write(BOOT_CODE, CSR_CPT_ADDR + 4096 * 8 - BOOT_CODE);
+    serializePMemSparse(filepath, pmem, PMEM_SIZE, deltaParent);
+    Log("Checkpoint done!\n");
+    regDumped = false;
+    return;
   }
 
-  gzFile compressed_mem = gzopen(filepath.c_str(), "wb");
+  if (checkpoint_threads > 1) {
+    compressPMemParallel(filepath, pmem, PMEM_SIZE);
+    Log("Checkpoint done!\n");
+    regDumped = false;
+    return;
+  }
+
+  string mode = "wb";
+  if (checkpoint_level != Z_DEFAULT_COMPRESSION) {
+    mode += to_string(checkpoint_level);
+  }
+  gzFile compressed_mem = gzopen(filepath.c_str(), mode.c_str());
   if (compressed_mem == nullptr) {
     cerr << "Failed to open " << filepath << endl;
     xpanic("Can't open physical memory checkpoint file!\n");
@@ -121,9 +276,10 @@ extern void csr_writeback();
 
 void Serializer::serializeRegs() {
   auto *intRegCpt = (uint64_t *) (get_pmem() + IntRegStartAddr);
-  for (unsigned i = 0; i < 32; i++) {
-    *(intRegCpt + i) = cpu.gpr[i]._64;
-  }
+  // Not an indexed loop: with CONFIG_MULTIHART, cpu is __thread, and LTO
+  // folds the loop bounds into its TLS offset, which fails to link with
+  // "relocation truncated to fit: R_X86_64_TPOFF32 against symbol `cpu'".
+  memcpy(intRegCpt, cpu.gpr, 32 * 8);
   Log("Writing int registers to checkpoint memory @[0x%x, 0x%x) [0x%x, 0x%x)",
       INT_REG_CPT_ADDR, INT_REG_CPT_ADDR + 32 * 8,
       IntRegStartAddr, IntRegStartAddr + 32 * 8
@@ -131,9 +287,7 @@ void Serializer::serializeRegs() {
 
 
   auto *floatRegCpt = (uint64_t *) (get_pmem() + FloatRegStartAddr);
-  for (unsigned i = 0; i < 32; i++) {
-    *(floatRegCpt + i) = cpu.fpr[i]._64;
-  }
+  memcpy(floatRegCpt, cpu.fpr, 32 * 8);
   Log("Writing float registers to checkpoint memory @[0x%x, 0x%x) [0x%x, 0x%x)",
       FLOAT_REG_CPT_ADDR, FLOAT_REG_CPT_ADDR + 32 * 8,
       FloatRegStartAddr, FloatRegStartAddr + 32 * 8
@@ -196,14 +350,61 @@ void Serializer::serializeRegs() {
 
 void Serializer::serialize(uint64_t inst_count) {
   pathManager.setOutputDir();
+  if (checkpoint_jobs > 0) {
+    // The checkpoint is written and compressed by a forked process from its
+    // copy-on-write snapshot of pmem, while the emulation goes on.
+    waitWorkers(checkpoint_jobs - 1);
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+      xpanic("Cannot fork a process to take checkpoint\n");
+    }
+    if (pid == 0) {
+      serializeRegs();
+      serializePMem(inst_count);
+      fflush(NULL);
+      _exit(0);
+    }
+    workersInFlight++;
+    Log("Checkpoint @ %lu is taken by process %d", inst_count, pid);
+  } else {
 //  isa_reg_display();
-  serializeRegs();
-  serializePMem(inst_count);
-
+    serializeRegs();
+    serializePMem(inst_count);
 //  isa_reg_display();
+  }
+
+  if (checkpoint_delta > 0) {
+    // the next checkpoint is a delta on this one, unless a new base is due
+    nrDelta = (nrDelta + 1) % checkpoint_delta;
+    deltaParent = nrDelta == 0 ? "" : std::filesystem::absolute(pmemFilePath(inst_count)).string();
+    pmem_dirty_clean();
+  }
+}
+
+void Serializer::waitWorkers(unsigned max_in_flight) {
+  while (workersInFlight > max_in_flight) {
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      xpanic("Lost the processes taking checkpoints\n");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      xpanic("Process %d failed to take checkpoint\n", pid);
+    }
+    workersInFlight--;
+  }
 }
 
 void Serializer::init() {
+  if (checkpoint_delta > 0) {
+    Log("Taking a full checkpoint every %d checkpoints, and deltas for the others", checkpoint_delta);
+    pmem_dirty_init();
+  }
+  if (checkpoint_jobs > 0) {
+    Log("Taking checkpoints with at most %d processes", checkpoint_jobs);
+    atexit(wait_cpt_workers);
+  }
   if  (profiling_state == SimpointCheckpointing) {
     assert(checkpoint_interval);
     intervalSize = checkpoint_interval;
@@ -277,6 +478,10 @@ Serializer serializer;
 
 extern "C" {
 
+void wait_cpt_workers() {
+  serializer.waitWorkers(0);
+}
+
 void init_serializer() {
   serializer.init();
 }
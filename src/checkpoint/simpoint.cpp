@@ -77,8 +77,13 @@ SimPoint::init() {
   if (profiling_state == SimpointProfiling) {
     assert(checkpoint_interval);
     intervalSize = checkpoint_interval;
+    binaryOutput = simpoint_binary;
+    bbCount.resize(1, 0);
+    simpoint_counters.bb_count = bbCount.data();
+    simpoint_counters.interval_end = intervalSize;
     Log("Doing simpoint profiling with interval %lu", intervalSize);
-    auto path = pathManager.getOutputPath() + "/simpoint_bbv.gz";
+    auto path = pathManager.getOutputPath() +
+      (binaryOutput ? "/simpoint_bbv.bin.gz" : "/simpoint_bbv.gz");
 
     using NEMUNS::simout;
     simpointStream = simout.create(path, false);
@@ -96,6 +101,62 @@ SimPoint::profile_with_abs_icount(Addr pc, bool is_control, bool is_last_uop, ui
   lastICount = abs_icount;
 }
 
+uint32_t
+SimPoint::lookup(const BasicBlockRange &bb, uint64_t insts) {
+  auto map_itr = bbMap.find(bb);
+  if (map_itr != bbMap.end())
+    return map_itr->second.id;
+
+  // If a new (previously unseen) basic block is found,
+  // add a new unique id, record num of insts and insert into bbMap.
+  BBInfo info;
+  info.id = bbMap.size() + 1;
+  info.insts = insts;
+  bbMap.insert(::std::make_pair(bb, info));
+  bbCount.resize(info.id + 1, 0);
+  simpoint_counters.bb_count = bbCount.data();
+  return info.id;
+}
+
+void
+SimPoint::count(uint32_t id, uint64_t insts) {
+  bbCount[id] += insts;
+}
+
+void
+SimPoint::dumpInterval() {
+  // summarize interval and display BBV info, the blocks executed are those
+  // with a count, in the order of their ids
+  std::ostream &os = *simpointStream->stream();
+
+  if (binaryOutput) {
+    uint32_t nr = 0;
+    for (uint32_t id = 1; id < bbCount.size(); id++)
+      nr += bbCount[id] != 0;
+    os.write((const char *)&nr, sizeof(nr));
+    for (uint32_t id = 1; id < bbCount.size(); id++) {
+      if (bbCount[id] == 0)
+        continue;
+      os.write((const char *)&id, sizeof(id));
+      os.write((const char *)&bbCount[id], sizeof(bbCount[id]));
+    }
+  } else {
+    // Print output BBV info
+    os << "T";
+    for (uint32_t id = 1; id < bbCount.size(); id++) {
+      if (bbCount[id] != 0)
+        os << ":" << id << ":" << bbCount[id] << " ";
+    }
+    os << "\n";
+  }
+
+  std::fill(bbCount.begin(), bbCount.end(), 0);
+  Log("Simpoint profilied %lu instrs", intervalCount);
+
+  intervalDrift = (intervalCount + intervalDrift) - intervalSize;
+  intervalCount = 0;
+}
+
 void
 SimPoint::profile(Addr pc, bool is_control, bool is_last_uop, unsigned instr_count) {
 
@@ -111,56 +172,35 @@ SimPoint::profile(Addr pc, bool is_control, bool is_last_uop, unsigned instr_cou
   // If inst is control inst, assume end of basic block.
   if (is_control) {
     currentBBV.second = pc;
-
-    auto map_itr = bbMap.find(currentBBV);
-    if (map_itr == bbMap.end()) {
-      // If a new (previously unseen) basic block is found,
-      // add a new unique id, record num of insts and insert into bbMap.
-      BBInfo info;
-      info.id = bbMap.size() + 1;
-      info.insts = currentBBVInstCount;
-      info.count = currentBBVInstCount;
-      bbMap.insert(::std::make_pair(currentBBV, info));
-    } else {
-      // If basic block is seen before, just increment the count by the
-      // number of insts in basic block.
-      BBInfo &info = map_itr->second;
-      info.count += currentBBVInstCount;
-    }
+    count(lookup(currentBBV, currentBBVInstCount), currentBBVInstCount);
     currentBBVInstCount = 0;
 
     // Reached end of interval if the sum of the current inst count
     // (intervalCount) and the excessive inst count from the previous
     // interval (intervalDrift) is greater than/equal to the interval size.
-    if (intervalCount + intervalDrift >= intervalSize) {
-      // summarize interval and display BBV info
-      std::vector<std::pair<uint64_t, uint64_t> > counts;
-      for (auto map_itr = bbMap.begin(); map_itr != bbMap.end();
-           ++map_itr) {
-        BBInfo &info = map_itr->second;
-        if (info.count != 0) {
-          counts.push_back(std::make_pair(info.id, info.count));
-          info.count = 0;
-        }
-      }
-      std::sort(counts.begin(), counts.end());
-
-      // Print output BBV info
-      *simpointStream->stream() << "T";
-      for (auto cnt_itr = counts.begin(); cnt_itr != counts.end();
-           ++cnt_itr) {
-        *simpointStream->stream() << ":" << cnt_itr->first
-                                  << ":" << cnt_itr->second << " ";
-      }
-      *simpointStream->stream() << "\n";
-      Log("Simpoint profilied %lu instrs", intervalCount);
-
-      intervalDrift = (intervalCount + intervalDrift) - intervalSize;
-      intervalCount = 0;
-    }
+    if (intervalCount + intervalDrift >= intervalSize)
+      dumpInterval();
   }
 }
 
+uint32_t
+SimPoint::profile_bb_id(uint32_t *id_slot, Addr pc, uint64_t insts) {
+  // Same as profile() with is_control set, but the hash table is only
+  // looked up the first time the block is entered from a trace cache entry.
+  uint32_t id = lookup(BasicBlockRange(pc, pc), insts);
+  if (id_slot)
+    *id_slot = id;
+  return id;
+}
+
+void
+SimPoint::profile_interval_end() {
+  SimpointCounters *c = &simpoint_counters;
+  intervalCount = intervalSize - intervalDrift + (c->last_icount - c->interval_end);
+  dumpInterval();
+  c->interval_end = c->last_icount + intervalSize - intervalDrift;
+}
+
 }
 
 SimPointNS::SimPoint simpoit_obj;
@@ -175,4 +215,12 @@ void simpoint_profiling(uint64_t pc, bool is_control, uint64_t abs_instr_count)
   simpoit_obj.profile_with_abs_icount(pc, is_control, true, abs_instr_count);
 }
 
+uint32_t simpoint_bb_id(uint32_t *id_slot, uint64_t pc, uint64_t insts) {
+  return simpoit_obj.profile_bb_id(id_slot, pc, insts);
+}
+
+void simpoint_interval_end() {
+  simpoit_obj.profile_interval_end();
+}
+
 }
\ No newline at end of file
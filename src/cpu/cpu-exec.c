@@ -21,7 +21,17 @@
 #include <cpu/decode.h>
 #include <memory/host-tlb.h>
 #include <isa-all-instr.h>
+#ifdef CONFIG_ENGINE_DBT
+#include <cpu/dbt.h>
+#endif
+#ifdef CONFIG_RV_DASICS
+#include "../local-include/intr.h"
+#endif
 #include <locale.h>
+#ifdef CONFIG_MULTIHART
+#include <pthread.h>
+#include <signal.h>
+#endif
 #include <setjmp.h>
 #include <unistd.h>
 
@@ -37,12 +47,12 @@
 #define BATCH_SIZE 1
 #endif
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_instr = 0;
+HART_LOCAL CPU_state cpu = {};
+HART_LOCAL uint64_t g_nr_guest_instr = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 const rtlreg_t rzero = 0;
-rtlreg_t tmp_reg[4];
+HART_LOCAL rtlreg_t tmp_reg[4];
 
 #ifdef CONFIG_DEBUG
 static inline void debug_hook(vaddr_t pc, const char *asmbuf) {
@@ -54,10 +64,17 @@ static inline void debug_hook(vaddr_t pc, const char *asmbuf) {
 }
 #endif
 
-static jmp_buf jbuf_exec = {};
-static uint64_t n_remain_total;
-static int n_remain;
-static Decode *prev_s;
+static HART_LOCAL jmp_buf jbuf_exec = {};
+static HART_LOCAL uint64_t n_remain_total;
+static HART_LOCAL int n_remain;
+static HART_LOCAL Decode *prev_s;
+
+#ifdef CONFIG_MULTIHART
+static HART_LOCAL int hart_id = 0;
+static pthread_t hart_thread[CONFIG_NR_HARTS];
+static bool harts_started = false;
+static uint64_t g_nr_hart_instr = 0; // executed by the harts other than hart 0
+#endif
 
 void save_globals(Decode *s) {
   IFDEF(CONFIG_PERF_OPT, prev_s = s);
@@ -89,16 +106,27 @@ void monitor_statistic() {
   setlocale(LC_NUMERIC, "");
   Log("host time spent = %'ld us", g_timer);
 #ifdef CONFIG_ENABLE_INSTR_CNT
-  Log("total guest instructions = %'ld", g_nr_guest_instr);
-  if (g_timer > 0) Log("simulation frequency = %'ld instr/s", g_nr_guest_instr * 1000000 / g_timer);
+  uint64_t nr_instr = g_nr_guest_instr + MUXDEF(CONFIG_MULTIHART, g_nr_hart_instr, 0);
+  Log("total guest instructions = %'ld", nr_instr);
+  if (g_timer > 0) Log("simulation frequency = %'ld instr/s", nr_instr * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
 #else
   Log("CONFIG_ENABLE_INSTR_CNT is not defined");
+#endif
+  IFDEF(CONFIG_HOSTTLB_STAT, hosttlb_statistic());
+#ifdef CONFIG_PERF_OPT
+  void tcache_statistic();
+  tcache_statistic();
+  IFDEF(CONFIG_ENGINE_DBT, dbt_statistic());
+#endif
+#ifdef CONFIG_RV_PTW_CACHE_STAT
+  void ptw_cache_statistic();
+  ptw_cache_statistic();
 #endif
 }
 
-static word_t g_ex_cause = 0;
-static int g_sys_state_flag = 0;
+static HART_LOCAL word_t g_ex_cause = 0;
+static HART_LOCAL int g_sys_state_flag = 0;
 
 void set_sys_state_flag(int flag) {
   g_sys_state_flag |= flag;
@@ -109,6 +137,11 @@ void mmu_tlb_flush(vaddr_t vaddr) {
   if (vaddr == 0) set_sys_state_flag(SYS_STATE_FLUSH_TCACHE);
 }
 
+void mmu_tlb_flush_asid(vaddr_t vaddr, word_t asid) {
+  hosttlb_flush_asid(vaddr, asid);
+  if (vaddr == 0) set_sys_state_flag(SYS_STATE_FLUSH_TCACHE);
+}
+
 _Noreturn
 void longjmp_exec(int cause) {
   Loge("Longjmp to jbuf_exec with cause: %i", cause);
@@ -129,28 +162,96 @@ void longjmp_exception(int ex_cause) {
 #define FILL_EXEC_TABLE(name) [concat(EXEC_ID_, name)] = &&concat(exec_, name),
 
 
+#ifdef CONFIG_TCACHE_TRACE
+// the inlined direction just moves on to the next instruction of the superblock
+#define trace_continue(s, dir) do { \
+  if (s->trace_dir == (dir)) { s ++; goto finish_label; } \
+} while (0)
+#define trace_profile(s, is_jmp) do { \
+  if (s->trace_cnt < CONFIG_TCACHE_TRACE_HOT) { \
+    s->trace_cnt ++; \
+    s->trace_taken += is_jmp; \
+    if (s->trace_cnt == CONFIG_TCACHE_TRACE_HOT) tcache_trace_form(s); \
+  } \
+} while (0)
+#else
+#define trace_continue(s, dir)
+#define trace_profile(s, is_jmp)
+#endif
+
+#ifdef CONFIG_RV_DASICS
+// `edge` indexes the verdict cached in `s` for the link followed, which is
+// tnext for jumps and taken branches, and ntnext for untaken branches
+#define dasics_cfi(s, target, type, edge, indirect) do { \
+  uint32_t dasics_tag = s->dasics_tag; \
+  if (unlikely((dasics_tag >> 4) != ((dasics_epoch << 2) | cpu.mode) || \
+      !(dasics_tag & DASICS_EDGE_ALLOWED(edge)))) \
+    dasics_cfi_check(s, target, type, edge, indirect); \
+} while (0)
+#else
+#define dasics_cfi(s, target, type, edge, indirect)
+#endif
+
+#ifdef CONFIG_TCACHE_RAS
+#define RAS_MASK ((1 << CONFIG_TCACHE_RAS_SIZE_SHIFT) - 1)
+// `link` caches the basic block returned to
+#define ras_push(s, link) do { \
+  Decode *r = link; \
+  if (unlikely(r == NULL)) r = tcache_ras_fetch(s); \
+  tcache_ras_top = (tcache_ras_top + 1) & RAS_MASK; \
+  tcache_ras[tcache_ras_top] = r; \
+} while (0)
+// ntnext of a direct call links to its return
+#define ras_push_j(s)  ras_push(s, s->ntnext)
+#define ras_push_jr(s) ras_push(s, s->jrc->rnext)
+// used by the returns instead of rtl_jr()
+#define ras_ret(s, target) do { \
+  dasics_cfi(s, *(target), CFI_JUMP, 0, true); \
+  IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
+  s = ras_fetch(s, *(target)); \
+  goto end_of_bb; \
+} while (0)
+#endif
+
+#define jr_stat(s, name) IFDEF(CONFIG_TCACHE_JR_STAT, (s)->jrc->name ++)
+
 #define rtl_j(s, target) do { \
+  dasics_cfi(s, target, CFI_JUMP, 0, false); \
+  trace_continue(s, TRACE_DIR_TAKEN); \
   IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
   s = s->tnext; \
   goto end_of_bb; \
 } while (0)
 #define rtl_jr(s, target) do { \
+  dasics_cfi(s, *(target), CFI_JUMP, 0, true); \
   IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
   s = jr_fetch(s, *(target)); \
   goto end_of_bb; \
 } while (0)
 #define rtl_jrelop(s, relop, src1, src2, target) do { \
-  IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
   bool is_jmp = interpret_relop(relop, *src1, *src2); \
+  dasics_cfi(s, is_jmp ? (target) : decode_snpc(s), CFI_BRANCH, !is_jmp, false); \
+  trace_continue(s, is_jmp ? TRACE_DIR_TAKEN : TRACE_DIR_NTAKEN); \
+  IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
+  trace_profile(s, is_jmp); \
   if (is_jmp) s = s->tnext; \
   else s = s->ntnext; \
   goto end_of_bb; \
 } while (0)
 
+// the second instruction of a fused pair, see isa_fuse()
+#define fuse_next(s, name) do { \
+  s ++; \
+  goto concat(exec_, name); \
+} while (0)
+#define fuse_skip(s) do { s ++; } while (0)
+
 #define rtl_priv_next(s) do { \
   if (g_sys_state_flag) { \
-    s = (g_sys_state_flag & SYS_STATE_FLUSH_TCACHE) ? \
-      tcache_handle_flush(s->snpc) : s + 1; \
+    if (g_sys_state_flag & SYS_STATE_FLUSH_TCACHE) s = tcache_handle_flush(decode_snpc(s)); \
+    IFDEF(CONFIG_TCACHE_SMC, \
+      else if (g_sys_state_flag & SYS_STATE_FLUSH_CODE) s = tcache_handle_code_flush(s);) \
+    else s = s + 1; \
     g_sys_state_flag = 0; \
     goto end_of_loop; \
   } \
@@ -172,30 +273,60 @@ Decode* tcache_jr_fetch(Decode *s, vaddr_t jpc);
 Decode* tcache_decode(Decode *s);
 void tcache_handle_exception(vaddr_t jpc);
 Decode* tcache_handle_flush(vaddr_t snpc);
+Decode* tcache_handle_code_flush(Decode *s);
+void tcache_trace_form(Decode *s);
+Decode* tcache_trace_redirect(Decode *s);
+Decode* tcache_ras_fetch(Decode *s);
+uint32_t* tcache_bbv_slot(Decode *s);
+extern HART_LOCAL Decode *tcache_ras[];
+extern HART_LOCAL int tcache_ras_top;
 
 static inline
 Decode* jr_fetch(Decode *s, vaddr_t target) {
-  if (likely(s->tnext->pc == target)) return s->tnext;
-  if (likely(s->ntnext->pc == target)) return s->ntnext;
+  if (likely(s->tnext->pc == target)) { jr_stat(s, hit); return s->tnext; }
+  if (likely(s->jrc->way[0]->pc == target)) { jr_stat(s, hit); return s->jrc->way[0]; }
   return tcache_jr_fetch(s, target);
 }
 
+#ifdef CONFIG_TCACHE_RAS
+static inline
+Decode* ras_fetch(Decode *s, vaddr_t target) {
+  Decode *r = tcache_ras[tcache_ras_top];
+  tcache_ras_top = (tcache_ras_top - 1) & RAS_MASK;
+  if (likely(r->pc == target)) { jr_stat(s, ras_hit); return r; }
+  return jr_fetch(s, target);
+}
+#endif
+
 static inline void debug_difftest(Decode *_this, Decode *next) {
-  IFDEF(CONFIG_IQUEUE, iqueue_commit(_this->pc, (void *)&_this->isa.instr.val, _this->snpc - _this->pc));
+  IFDEF(CONFIG_IQUEUE, iqueue_commit(_this->pc, (void *)&_this->isa.instr.val, _this->ilen));
   IFDEF(CONFIG_DEBUG, debug_hook(_this->pc, _this->logbuf));
   IFDEF(CONFIG_DIFFTEST, save_globals(next));
   IFDEF(CONFIG_DIFFTEST, cpu.pc = next->pc);
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, next->pc));
 }
 
-uint64_t per_bb_profile(Decode *s) {
-  uint64_t abs_inst_count = get_abs_instr_count();
-  if (profiling_state == SimpointProfiling && profiling_started) {
-    simpoint_profiling(s->pc, true, abs_inst_count);
-  }
+// Count the basic block which has just ended, which leads to `s`. SimPoint
+// is only called when the trace cache entry at `s` has no block id yet, and
+// at the end of an interval.
+static inline void simpoint_profile_bb(Decode *s, uint64_t abs_inst_count) {
+  extern uint32_t simpoint_bb_id(uint32_t *id_slot, uint64_t pc, uint64_t insts);
+  extern void simpoint_interval_end();
+  SimpointCounters *c = &simpoint_counters;
+  uint64_t insts = abs_inst_count - c->last_icount;
+  c->last_icount = abs_inst_count;
+  uint32_t *slot = tcache_bbv_slot(s);
+  uint32_t id = (slot != NULL ? *slot : 0);
+  if (unlikely(id == 0)) id = simpoint_bb_id(slot, s->pc, insts);
+  c->bb_count[id] += insts;
+  if (unlikely(abs_inst_count >= c->interval_end)) simpoint_interval_end();
+}
 
+// kept out of the interpreter loop, which only checks checkpoint_taking
+__attribute__((noinline))
+static void per_bb_checkpoint(Decode *s, uint64_t abs_inst_count) {
   extern bool able_to_take_cpt();
-  if (checkpoint_taking && profiling_started && (force_cpt_mmode || able_to_take_cpt())) {
+  if (profiling_started && (force_cpt_mmode || able_to_take_cpt())) {
     // update cpu pc!
     cpu.pc = s->pc;
 
@@ -205,6 +336,14 @@ uint64_t per_bb_profile(Decode *s) {
       Log("Should take checkpoint on pc 0x%lx", s->pc);
     }
   }
+}
+
+static inline uint64_t per_bb_profile(Decode *s) {
+  uint64_t abs_inst_count = get_abs_instr_count();
+  if (profiling_state == SimpointProfiling && profiling_started) {
+    simpoint_profile_bb(s, abs_inst_count);
+  }
+  if (unlikely(checkpoint_taking)) per_bb_checkpoint(s, abs_inst_count);
   return abs_inst_count;
 }
 
@@ -213,13 +352,15 @@ static int execute(int n) {
   static const void* local_exec_table[TOTAL_INSTR] = {
     MAP(INSTR_LIST, FILL_EXEC_TABLE)
   };
-  static int init_flag = 0;
+  static HART_LOCAL int init_flag = 0;
   Decode *s = prev_s;
 
   if (likely(init_flag == 0)) {
     g_exec_table = local_exec_table;
-    extern Decode* tcache_init(const void *exec_nemu_decode, vaddr_t reset_vector);
-    s = tcache_init(&&exec_nemu_decode, cpu.pc);
+    IFDEF(CONFIG_ENGINE_DBT, dbt_init(&&exec_nemu_dbt, &&exec_nemu_dbt_profile, local_exec_table, TOTAL_INSTR));
+    extern Decode* tcache_init(const void *exec_nemu_decode, const void *exec_nemu_trace_redirect,
+        vaddr_t reset_vector);
+    s = tcache_init(&&exec_nemu_decode, &&exec_nemu_trace_redirect, cpu.pc);
     IFDEF(CONFIG_MODE_SYSTEM, hosttlb_init());
     init_flag = 1;
   }
@@ -247,6 +388,27 @@ def_EHelper(nemu_decode) {
   continue;
 }
 
+// entry of a block superseded by a superblock or dropped for self-modifying
+// code, reached through stale links
+def_EHelper(nemu_trace_redirect) {
+  s = tcache_trace_redirect(s);
+  continue;
+}
+
+#ifdef CONFIG_ENGINE_DBT
+// entry of a run of instructions translated into host code, which returns
+// the first instruction left to the interpreter
+def_EHelper(nemu_dbt) {
+  s = dbt_exec(s);
+  continue;
+}
+
+// entry of a basic block not hot enough to be translated yet
+def_EHelper(nemu_dbt_profile) {
+  goto *dbt_profile(s);
+}
+#endif
+
 end_of_bb:
     IFDEF(CONFIG_ENABLE_INSTR_CNT, n_remain = n);
     IFNDEF(CONFIG_ENABLE_INSTR_CNT, n --);
@@ -269,6 +431,8 @@ end_of_loop:
   // Here is per loop action and some priv instruction action
   Loge("end_of_loop: prev pc = 0x%lx, pc = 0x%lx, total insts: %lu, remain: %lu",
        prev_s->pc, s->pc, get_abs_instr_count(), n_remain_total);
+  // the privileged instructions leave here without passing end_of_bb
+  IFDEF(CONFIG_ENABLE_INSTR_CNT, n_remain = n);
   per_bb_profile(s);
 
   debug_difftest(this_s, s);
@@ -292,8 +456,8 @@ static int execute(int n) {
   for (;n > 0; n --) {
     fetch_decode(&s, cpu.pc);
     cpu.debug.current_pc = s.pc;
-    s.prev_pc = cpu.pc;
-    cpu.pc = s.snpc;
+    IFDEF(CONFIG_RV_DASICS, s.prev_pc = cpu.pc);
+    cpu.pc = decode_snpc(&s);
 #ifdef CONFIG_SHARE
     if (unlikely(dynamic_config.debug_difftest)) {
       fprintf(stderr, "(%d) [NEMU] pc = 0x%lx inst %x\n", getpid(), s.pc, s.isa.instr.val);
@@ -319,17 +483,26 @@ static int execute(int n) {
 }
 #endif
 
-void fetch_decode(Decode *s, vaddr_t pc) {
+int fetch_decode(Decode *s, vaddr_t pc) {
   s->pc = pc;
-  s->snpc = pc;
   IFDEF(CONFIG_DEBUG, log_bytebuf[0] = '\0');
   int idx = isa_fetch_decode(s);
   Logtid(FMT_WORD ":   %s%*.s%s",
-        s->pc, log_bytebuf, 40 - (12 + 3 * (int)(s->snpc - s->pc)), "", log_asmbuf);
+        s->pc, log_bytebuf, 40 - (12 + 3 * s->ilen), "", log_asmbuf);
   IFDEF(CONFIG_DEBUG, snprintf(s->logbuf, sizeof(s->logbuf), FMT_WORD ":   %s%*.s%s",
-        s->pc, log_bytebuf, 40 - (12 + 3 * (int)(s->snpc - s->pc)), "", log_asmbuf));
+        s->pc, log_bytebuf, 40 - (12 + 3 * s->ilen), "", log_asmbuf));
   s->EHelper = g_exec_table[idx];
+  return idx;
+}
+
+#ifdef CONFIG_TCACHE_FUSE
+bool fuse_decode(Decode *prev, int prev_idx, Decode *s, int *idx) {
+  if (!isa_fuse(prev, &prev_idx, s, idx)) return false;
+  prev->EHelper = g_exec_table[prev_idx];
+  s->EHelper = g_exec_table[*idx];
+  return true;
 }
+#endif
 
 #ifdef CONFIG_PERF_OPT
 static void update_global() {
@@ -338,26 +511,22 @@ static void update_global() {
 }
 #endif
 
-/* Simulate how the CPU works. */
-void cpu_exec(uint64_t n) {
-  IFDEF(CONFIG_SHARE, assert(n <= 1));
-  g_print_step = (n < MAX_INSTR_TO_PRINT);
-  switch (nemu_state.state) {
-    case NEMU_END: case NEMU_ABORT:
-      printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
-      return;
-    default:
-      nemu_state.state = NEMU_RUNNING;
-      Loge("Setting NEMU state to RUNNING");
-  }
-
-  uint64_t timer_start = get_time();
-
+// Run the hart on the calling thread until it has executed n instructions,
+// or the emulation is stopped.
+static void hart_exec(uint64_t n) {
   n_remain_total = n; // deal with setjmp()
   Loge("cpu_exec will exec %lu instrunctions", n_remain_total);
   int cause;
   if ((cause = setjmp(jbuf_exec))) {
     n_remain -= prev_s->idx_in_bb - 1;
+#if defined(CONFIG_RV_DASICS) && defined(CONFIG_PERF_OPT)
+    // A jump denied by dasics_cfi_check() is the faulting instruction, but it
+    // is counted as executed, as when the fault was taken on fetching its target.
+    if (cause == NEMU_EXEC_EXCEPTION && (g_ex_cause == EX_DUCF || g_ex_cause == EX_DSCF) &&
+        dfreason->val == DFR_JF) {
+      n_remain --;
+    }
+#endif
     // Here is exception handle
 #ifdef CONFIG_PERF_OPT
     update_global();
@@ -365,18 +534,20 @@ void cpu_exec(uint64_t n) {
     Loge("After update_global, n_remain: %i, n_remain_total: %li", n_remain, n_remain_total);
   }
 
-  while (nemu_state.state == NEMU_RUNNING &&
+  while (__atomic_load_n(&nemu_state.state, __ATOMIC_RELAXED) == NEMU_RUNNING &&
       MUXDEF(CONFIG_ENABLE_INSTR_CNT, n_remain_total > 0, true)) {
 #ifdef CONFIG_DEVICE
     extern void device_update();
-    device_update();
+    if (MUXDEF(CONFIG_MULTIHART, hart_id == 0, true)) device_update();
 #endif
+    IFDEF(CONFIG_MULTIHART, isa_poll_intr());
 
     if (cause == NEMU_EXEC_EXCEPTION) {
       Loge("Handle NEMU_EXEC_EXCEPTION");
       cause = 0;
       vaddr_t temp_epc = prev_s->pc;
-#ifdef CONFIG_RV_DASICS
+#if defined(CONFIG_RV_DASICS) && !defined(CONFIG_PERF_OPT)
+      // with the trace cache, prev_s is already the jump, see dasics_cfi_check()
       if((g_ex_cause == EX_DUCF || g_ex_cause == EX_DSCF) && dfreason->val == DFR_JF){
         temp_epc = prev_s->prev_pc;
         prev_s->prev_is_cfi = 0;
@@ -407,11 +578,116 @@ void cpu_exec(uint64_t n) {
     n_remain_total -= n_batch;
 #endif
   }
+}
 
-  // If nemu_state.state is NEMU_RUNNING, n_remain_total should be zero.
-  if (nemu_state.state == NEMU_RUNNING) {
-    nemu_state.state = NEMU_QUIT;
+#ifdef CONFIG_MULTIHART
+static pthread_mutex_t harts_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t harts_cond = PTHREAD_COND_INITIALIZER;
+static int harts_idle = 0; // harts waiting for hart 0 to resume the emulation
+
+static bool emulation_ended(int state) {
+  return state == NEMU_END || state == NEMU_ABORT;
+}
+
+// The other harts run on their own threads. When hart 0 returns to the
+// monitor, they wait for the next cpu_exec() without touching any shared
+// state, and they exit once any hart ends the emulation.
+static void* hart_main(void *arg) {
+  // the timer signal is left to hart 0, which updates the devices
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGVTALRM);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  hart_id = (intptr_t)arg;
+  isa_init_hart(hart_id);
+  while (true) {
+    int state = __atomic_load_n(&nemu_state.state, __ATOMIC_ACQUIRE);
+    if (emulation_ended(state)) break;
+    if (state != NEMU_RUNNING) {
+      pthread_mutex_lock(&harts_lock);
+      harts_idle ++;
+      pthread_cond_broadcast(&harts_cond);
+      while ((state = __atomic_load_n(&nemu_state.state, __ATOMIC_ACQUIRE)) != NEMU_RUNNING &&
+          !emulation_ended(state)) {
+        pthread_cond_wait(&harts_cond, &harts_lock);
+      }
+      harts_idle --;
+      pthread_mutex_unlock(&harts_lock);
+      continue;
+    }
+    hart_exec(-1);
+    __atomic_fetch_add(&g_nr_hart_instr, g_nr_guest_instr, __ATOMIC_RELAXED);
+    g_nr_guest_instr = 0;
+  }
+  pthread_mutex_lock(&harts_lock);
+  pthread_cond_broadcast(&harts_cond);
+  pthread_mutex_unlock(&harts_lock);
+  return NULL;
+}
+
+// called after nemu_state.state is set to NEMU_RUNNING
+static void harts_start() {
+  if (harts_started) {
+    pthread_mutex_lock(&harts_lock);
+    pthread_cond_broadcast(&harts_cond);
+    pthread_mutex_unlock(&harts_lock);
+    return;
+  }
+  for (int i = 1; i < CONFIG_NR_HARTS; i ++) {
+    int ret = pthread_create(&hart_thread[i], NULL, hart_main, (void *)(intptr_t)i);
+    Assert(ret == 0, "Can not create the thread of hart %d", i);
+  }
+  harts_started = true;
+  Log("Started %d harts", CONFIG_NR_HARTS);
+}
+
+// Called on every return of cpu_exec(), once nemu_state.state is no longer
+// NEMU_RUNNING. The harts are joined if the emulation has ended, otherwise
+// this waits until all of them are idle.
+static void harts_stop() {
+  if (!harts_started) return;
+  pthread_mutex_lock(&harts_lock);
+  pthread_cond_broadcast(&harts_cond);
+  // a hart still running may end the emulation in the meantime
+  bool ended;
+  while (!(ended = emulation_ended(__atomic_load_n(&nemu_state.state, __ATOMIC_ACQUIRE))) &&
+      harts_idle < CONFIG_NR_HARTS - 1) {
+    pthread_cond_wait(&harts_cond, &harts_lock);
+  }
+  pthread_mutex_unlock(&harts_lock);
+  if (!ended) return;
+  for (int i = 1; i < CONFIG_NR_HARTS; i ++) {
+    pthread_join(hart_thread[i], NULL);
   }
+  harts_started = false;
+}
+#endif
+
+/* Simulate how the CPU works. */
+void cpu_exec(uint64_t n) {
+  IFDEF(CONFIG_SHARE, assert(n <= 1));
+  g_print_step = (n < MAX_INSTR_TO_PRINT);
+  switch (__atomic_load_n(&nemu_state.state, __ATOMIC_ACQUIRE)) {
+    case NEMU_END: case NEMU_ABORT:
+      printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
+      return;
+    default:
+      __atomic_store_n(&nemu_state.state, NEMU_RUNNING, __ATOMIC_RELEASE);
+      Loge("Setting NEMU state to RUNNING");
+  }
+
+  IFDEF(CONFIG_MULTIHART, harts_start());
+  uint64_t timer_start = get_time();
+
+  hart_exec(n);
+
+  // If nemu_state.state is NEMU_RUNNING, n_remain_total should be zero.
+  // Another hart may end the emulation at the same time, and then it wins.
+  int running = NEMU_RUNNING;
+  __atomic_compare_exchange_n(&nemu_state.state, &running, NEMU_QUIT, false,
+      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  IFDEF(CONFIG_MULTIHART, harts_stop());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -48,6 +48,7 @@ static void nemu_large_memcpy(void *dest, void *src, size_t n) {
 #endif
 
 void difftest_memcpy(paddr_t nemu_addr, void *dut_buf, size_t n, bool direction) {
+  IFDEF(CONFIG_TCACHE_SMC, if (direction == DIFFTEST_TO_REF) pmem_code_write(nemu_addr, n));
 #ifdef CONFIG_LARGE_COPY
   if (direction == DIFFTEST_TO_REF) nemu_large_memcpy(guest_to_host(nemu_addr), dut_buf, n);
   else nemu_large_memcpy(dut_buf, guest_to_host(nemu_addr), n);
@@ -15,61 +15,209 @@
 
 #include <cpu/decode.h>
 #include <cpu/cpu.h>
+#include <checkpoint/profiling.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/host-tlb.h>
+#include <stdlib.h>
+#ifdef CONFIG_ENGINE_DBT
+#include <cpu/dbt.h>
+#endif
 
 #ifdef CONFIG_PERF_OPT
 
 #define TCACHE_BB_SIZE (CONFIG_TCACHE_SIZE / 4 + 2)
 
 typedef struct bb_t {
-  Decode *s;
-  struct bb_t *next;
   vaddr_t pc;
+  Decode *s;
 } bb_t;
 
+#define BB_EMPTY ((vaddr_t)-1ul)
+
 enum { BB_RECORD_TYPE_NTAKEN = 1, BB_RECORD_TYPE_TAKEN };
 
-static Decode tcache_pool[CONFIG_TCACHE_SIZE] = {};
-static int tc_idx = 0;
-static Decode tcache_bb_pool[TCACHE_BB_SIZE] = {};
-static Decode *tcache_bb_freelist = NULL;
-static bb_t bb_pool[CONFIG_BB_POOL_SIZE] = {};
-static int bb_idx = 0;
-static bb_t bb_list [CONFIG_BB_LIST_SIZE] = {};
-static const void *g_exec_nemu_decode;
+#ifdef CONFIG_TCACHE_SMC
+// physical pages of the first and the last byte of an instruction
+typedef struct {
+  paddr_t first, last;
+} CodePage;
+#endif
+
+// Decoded instructions are allocated from chunks of CONFIG_TCACHE_SIZE
+// entries, and a basic block never crosses two chunks. Chunks are filled
+// one after another. Once CONFIG_TCACHE_MAX_CHUNKS of them are allocated,
+// the oldest one is evicted and reused instead of flushing everything.
+typedef struct {
+  Decode *pool;
+  JRCache *jrc; // indexed as pool, only used by indirect jumps
+  IFDEF(CONFIG_TCACHE_SMC, CodePage *code); // indexed as pool
+  uint32_t *bbv_id; // indexed as pool, SimPoint id of the basic block entered here, 0 if unknown
+  int idx;
+} TCacheChunk;
+
+// bbv_id is allocated right before pool, at an alignment of their total size
+// rounded up to a power of 2. So the slot of an entry is found from its
+// address alone, see tcache_bbv_slot().
+#define TCACHE_BBV_BYTES ROUNDUP(sizeof(uint32_t) * CONFIG_TCACHE_SIZE, 64)
+#define TCACHE_CHUNK_BYTES (TCACHE_BBV_BYTES + sizeof(Decode) * CONFIG_TCACHE_SIZE)
+#define TCACHE_CHUNK_ALIGN (1ul << (64 - __builtin_clzl(TCACHE_CHUNK_BYTES - 1)))
+
+static HART_LOCAL TCacheChunk tc_chunk[CONFIG_TCACHE_MAX_CHUNKS] = {};
+static HART_LOCAL int tc_nr_chunk = 0;
+static HART_LOCAL int tc_cur = 0;
+// records of basic blocks which are not decoded yet, allocated in blocks of TCACHE_BB_SIZE
+static HART_LOCAL Decode **tcache_bb_block = NULL;
+static HART_LOCAL int tcache_nr_bb_block = 0;
+static HART_LOCAL Decode *tcache_bb_freelist = NULL;
+// Basic blocks are looked up in an open addressing hash table with robin
+// hood hashing. It is doubled when it becomes 3/4 full.
+static HART_LOCAL bb_t *bb_list = NULL;
+static HART_LOCAL uint32_t bb_list_size = 0, bb_list_nr = 0;
+static HART_LOCAL const void *g_exec_nemu_decode;
+static HART_LOCAL const void *g_exec_nemu_trace_redirect;
+
+static HART_LOCAL struct {
+  uint64_t flush, evict;
+  IFDEF(CONFIG_TCACHE_SMC, uint64_t code_flush; uint64_t code_drop);
+  IFDEF(CONFIG_TCACHE_JR_STAT, uint64_t jr_hit; uint64_t jr_ras_hit; uint64_t jr_miss);
+  IFDEF(CONFIG_TCACHE_FUSE, uint64_t fuse);
+} tc_stat = {};
+
+// target of empty indirect jump cache ways and return address stack entries
+static Decode tcache_jr_none = { .pc = (vaddr_t)-1ul };
+
+#ifdef CONFIG_TCACHE_RAS
+HART_LOCAL Decode *tcache_ras[1 << CONFIG_TCACHE_RAS_SIZE_SHIFT];
+HART_LOCAL int tcache_ras_top = 0;
+#endif
+
+static inline void tcache_ras_reset() {
+#ifdef CONFIG_TCACHE_RAS
+  for (int i = 0; i < ARRLEN(tcache_ras); i ++) { tcache_ras[i] = &tcache_jr_none; }
+#endif
+}
 
 static inline Decode* tcache_entry_init(Decode *s, vaddr_t pc) {
   s->tnext = s->ntnext = NULL;
   s->type = 0;
+  IFDEF(CONFIG_TCACHE_TRACE, s->trace_dir = TRACE_DIR_NONE);
+  IFDEF(CONFIG_TCACHE_TRACE, s->trace_cnt = s->trace_taken = 0);
   s->pc = pc;
   s->EHelper = g_exec_nemu_decode;
   return s;
 }
 
 static inline Decode* tcache_new(vaddr_t pc) {
-  if (tc_idx == CONFIG_TCACHE_SIZE) return NULL;
-  assert(tc_idx < CONFIG_TCACHE_SIZE);
-  Decode *s = &tcache_pool[tc_idx];
-  tc_idx ++;
+  TCacheChunk *c = &tc_chunk[tc_cur];
+  if (c->idx == CONFIG_TCACHE_SIZE) return NULL;
+  assert(c->idx < CONFIG_TCACHE_SIZE);
+  Decode *s = &c->pool[c->idx];
+  c->bbv_id[c->idx] = 0;
+  c->idx ++;
   return tcache_entry_init(s, pc);
 }
 
+static inline bool tcache_in_chunk(TCacheChunk *c, Decode *s) {
+  return s >= c->pool && s < c->pool + c->idx;
+}
+
+// SimPoint profiling keeps the id of the basic block entered at `s` here, so
+// that it is only looked up once for each decoded block. Entries still to be
+// decoded may be records outside the chunks, and have no slot.
+uint32_t* tcache_bbv_slot(Decode *s) {
+  if (unlikely(s->EHelper == g_exec_nemu_decode)) return NULL;
+  uint8_t *base = (uint8_t *)ROUNDDOWN(s, TCACHE_CHUNK_ALIGN);
+  return (uint32_t *)base + (s - (Decode *)(base + TCACHE_BBV_BYTES));
+}
+
+#ifdef CONFIG_TCACHE_SMC
+static inline TCacheChunk* tcache_chunk_of(Decode *s) {
+  for (int i = 0; i < tc_nr_chunk; i ++) {
+    if (tcache_in_chunk(&tc_chunk[i], s)) return &tc_chunk[i];
+  }
+  assert(0);
+}
+
+static inline CodePage* tcache_code_page(Decode *s) {
+  TCacheChunk *c = tcache_chunk_of(s);
+  return &c->code[s - c->pool];
+}
+
+// Record where the instruction just decoded at `s` is fetched from.
+static inline void tcache_code_record(Decode *s) {
+  TCacheChunk *c = &tc_chunk[tc_cur];
+  assert(tcache_in_chunk(c, s));
+  CodePage *cp = &c->code[s - c->pool];
+  vaddr_t last = decode_snpc(s) - 1;
+  cp->first = hosttlb_ifetch_paddr(s->pc);
+  cp->last = (((s->pc ^ last) & ~(vaddr_t)PAGE_MASK) == 0 ? cp->first : hosttlb_ifetch_paddr(last));
+  pmem_code_mark(cp->first);
+  pmem_code_mark(cp->last);
+}
+#endif
+
+static inline void tcache_jr_init(Decode *s) {
+  TCacheChunk *c = &tc_chunk[tc_cur];
+  assert(tcache_in_chunk(c, s));
+  s->tnext = &tcache_jr_none;
+  s->jrc = &c->jrc[s - c->pool];
+  IFDEF(CONFIG_TCACHE_RAS, s->jrc->rnext = NULL);
+  for (int i = 0; i < ARRLEN(s->jrc->way); i ++) { s->jrc->way[i] = &tcache_jr_none; }
+  IFDEF(CONFIG_TCACHE_JR_STAT, s->jrc->hit = s->jrc->ras_hit = s->jrc->miss = 0);
+}
+
+#ifdef CONFIG_TCACHE_JR_STAT
+// keep the counters of indirect jumps in chunk `c` before they are dropped
+static void tcache_jr_stat_retire(TCacheChunk *c) {
+  for (Decode *p = c->pool; p < c->pool + c->idx; p ++) {
+    if (p->type != INSTR_TYPE_I) continue;
+    tc_stat.jr_hit += p->jrc->hit;
+    tc_stat.jr_ras_hit += p->jrc->ras_hit;
+    tc_stat.jr_miss += p->jrc->miss;
+  }
+}
+#endif
+
 #ifdef CONFIG_RT_CHECK
-#define tcache_bb_check(s) do { \
-  int idx = s - tcache_bb_pool; \
-  Assert(idx >= 0 && idx < TCACHE_BB_SIZE, "idx = %d, s = %p", idx, s); \
-} while (0)
+static inline bool tcache_bb_valid(Decode *s) {
+  if (s == NULL) return true;
+  for (int i = 0; i < tcache_nr_bb_block; i ++) {
+    int idx = s - tcache_bb_block[i];
+    if (idx >= 0 && idx < TCACHE_BB_SIZE) return true;
+  }
+  return false;
+}
+#define tcache_bb_check(s) Assert(tcache_bb_valid(s), "s = %p", s)
 #else
 #define tcache_bb_check(s)
 #endif
 
+static void tcache_bb_block_free(Decode *block) {
+  int i;
+  for (i = 0; i < TCACHE_BB_SIZE; i ++) {
+    block[i].list_next = (i == TCACHE_BB_SIZE - 1 ? tcache_bb_freelist : &block[i + 1]);
+    block[i].bb_src = NULL;
+  }
+  tcache_bb_freelist = &block[0];
+}
+
+static void tcache_bb_grow() {
+  Decode *block = malloc(sizeof(Decode) * TCACHE_BB_SIZE);
+  assert(block != NULL);
+  tcache_bb_block = realloc(tcache_bb_block, sizeof(Decode *) * (tcache_nr_bb_block + 1));
+  assert(tcache_bb_block != NULL);
+  tcache_bb_block[tcache_nr_bb_block ++] = block;
+  tcache_bb_block_free(block);
+}
+
 static inline Decode* tcache_bb_new(vaddr_t pc) {
+  if (tcache_bb_freelist == NULL) tcache_bb_grow();
   Decode *s = tcache_bb_freelist;
-  assert(s != NULL);
   tcache_bb_check(s);
   tcache_bb_check(tcache_bb_freelist->tnext);
   tcache_bb_freelist = tcache_bb_freelist->tnext;
   tcache_bb_check(tcache_bb_freelist);
-  tcache_bb_check(tcache_bb_freelist->tnext);
   return tcache_entry_init(s, pc);
 }
 
@@ -77,59 +225,98 @@ static inline void tcache_bb_free(Decode *s) {
   tcache_bb_check(s);
   tcache_bb_check(tcache_bb_freelist);
   s->tnext = tcache_bb_freelist;
+  s->bb_src = NULL;
   tcache_bb_freelist = s;
-  tcache_bb_check(tcache_bb_freelist->tnext);
 }
 
 
-static inline bb_t* bb_new(Decode *s, vaddr_t pc, bb_t *next) {
-  if (bb_idx == CONFIG_BB_POOL_SIZE) return NULL;
-  assert(bb_idx < CONFIG_BB_POOL_SIZE);
-  bb_t *bb = &bb_pool[bb_idx ++];
-  bb->s = s;
-  bb->pc = pc;
-  bb->next = next;
-  return bb;
+static inline uint32_t bb_hash(vaddr_t pc) {
+  return ((uint64_t)(pc / CONFIG_ILEN_MIN) * 0x9e3779b97f4a7c15ull) >> 32;
 }
 
-static inline bb_t* bb_hash(vaddr_t pc) {
-  int idx = (pc / CONFIG_ILEN_MIN) % CONFIG_BB_LIST_SIZE;
-  return &bb_list[idx];
+// distance of the entry at `idx` from its home slot
+static inline uint32_t bb_dist(uint32_t idx, vaddr_t pc) {
+  return (idx - bb_hash(pc)) & (bb_list_size - 1);
 }
 
-static struct bb_t* bb_insert(vaddr_t pc, Decode *fill) {
-  bb_t *head = bb_hash(pc);
-  if (head->next == (void *)-1ul) {
-    if (head->pc == (vaddr_t)-1ul) {
-      // first time
-      head->s = fill;
-      head->pc = pc;
-      return head;
+static bb_t* bb_find(vaddr_t pc) {
+  uint32_t mask = bb_list_size - 1;
+  uint32_t idx = bb_hash(pc) & mask;
+  bb_t *bb = &bb_list[idx];
+  if (likely(bb->pc == pc)) return bb;
+  uint32_t dist = 0;
+  do {
+    // a richer entry means `pc` would have taken its slot
+    if (bb->pc == BB_EMPTY || bb_dist(idx, bb->pc) < dist) return NULL;
+    idx = (idx + 1) & mask;
+    dist ++;
+    bb = &bb_list[idx];
+  } while (bb->pc != pc);
+  return bb;
+}
+
+static void bb_list_put(bb_t e) {
+  uint32_t mask = bb_list_size - 1;
+  uint32_t idx = bb_hash(e.pc) & mask;
+  for (uint32_t dist = 0; ; idx = (idx + 1) & mask, dist ++) {
+    bb_t *bb = &bb_list[idx];
+    if (bb->pc == BB_EMPTY) { *bb = e; return; }
+    uint32_t d = bb_dist(idx, bb->pc);
+    if (d < dist) {
+      bb_t tmp = *bb; *bb = e; e = tmp;
+      dist = d;
     }
   }
-  // second time
-  bb_t *bb = bb_new(head->s, head->pc, head->next);
-  if (bb == NULL) return NULL;
-  head->s = fill;
-  head->pc = pc;
-  head->next = bb;
-  return head;
 }
 
-static bb_t* bb_find(vaddr_t pc) {
-  bb_t *bb = bb_hash(pc);
-  if (likely(bb->pc == pc)) return bb;
-  bb_t *head = bb;
-  do {
-    bb = bb->next;
-    if (bb == (void *)-1ul) return NULL;
-    if (bb->pc == pc) {
-      Decode *tmp_s = bb->s; vaddr_t tmp_pc = bb->pc;
-      bb->s = head->s; bb->pc = head->pc;
-      head->s = tmp_s; head->pc = tmp_pc;
-      return head;
+static void bb_list_alloc(uint32_t size) {
+  bb_list = malloc(sizeof(bb_t) * size);
+  assert(bb_list != NULL);
+  memset(bb_list, -1, sizeof(bb_t) * size);
+  bb_list_size = size;
+}
+
+static void bb_insert(vaddr_t pc, Decode *fill) {
+  bb_t *bb = bb_find(pc);
+  if (bb != NULL) { bb->s = fill; return; }
+  if ((bb_list_nr + 1) * 4 > bb_list_size * 3) {
+    bb_t *old = bb_list;
+    uint32_t old_size = bb_list_size;
+    bb_list_alloc(old_size * 2);
+    for (uint32_t i = 0; i < old_size; i ++) {
+      if (old[i].pc != BB_EMPTY) bb_list_put(old[i]);
     }
-  } while (1);
+    free(old);
+  }
+  bb_list_put((bb_t){ .pc = pc, .s = fill });
+  bb_list_nr ++;
+}
+
+// Remove the entry at `idx` by shifting the following ones in the cluster backward.
+static void bb_list_delete(uint32_t idx) {
+  uint32_t mask = bb_list_size - 1;
+  uint32_t next = (idx + 1) & mask;
+  while (bb_list[next].pc != BB_EMPTY && bb_dist(next, bb_list[next].pc) > 0) {
+    bb_list[idx] = bb_list[next];
+    idx = next;
+    next = (next + 1) & mask;
+  }
+  bb_list[idx].pc = BB_EMPTY;
+  bb_list_nr --;
+}
+
+// Remove the basic blocks in chunk `c` from the list, or all of them if `c` is NULL.
+static void bb_list_remove(TCacheChunk *c) {
+  if (c == NULL) {
+    memset(bb_list, -1, sizeof(bb_t) * bb_list_size);
+    bb_list_nr = 0;
+    return;
+  }
+  for (uint32_t i = 0; i < bb_list_size; ) {
+    // entries shifted into slot `i` have to be checked again
+    if (bb_list[i].pc != BB_EMPTY && tcache_in_chunk(c, bb_list[i].s)) bb_list_delete(i);
+    else i ++;
+  }
 }
 
 static void tcache_bb_fetch(Decode *_this, int is_taken, vaddr_t jpc) {
@@ -145,30 +332,346 @@ static void tcache_bb_fetch(Decode *_this, int is_taken, vaddr_t jpc) {
   }
 }
 
+// ntnext shares its space with the jump cache of indirect jumps and the host code of other instructions
+static inline bool tcache_has_ntnext(Decode *s) {
+  return s->type == INSTR_TYPE_J || s->type == INSTR_TYPE_B;
+}
+
+// A link to an evicted entry `dst` turns into a record of a not yet decoded basic block.
+// Targets cached by indirect jumps are just forgotten.
+static inline Decode* tcache_unlink(Decode *src, Decode *dst, int is_taken) {
+  if (src->type == INSTR_TYPE_I) return &tcache_jr_none;
+  if (src->type == INSTR_TYPE_J && !is_taken) return NULL; // return address stack link
+  Decode *ret = tcache_bb_new(dst->pc);
+  ret->type = (is_taken ? BB_RECORD_TYPE_TAKEN : BB_RECORD_TYPE_NTAKEN);
+  ret->bb_src = src;
+  return ret;
+}
+
+static void tcache_chunk_evict(TCacheChunk *c) {
+  if (c->idx == 0) return;
+  tc_stat.evict ++;
+  IFDEF(CONFIG_TCACHE_JR_STAT, tcache_jr_stat_retire(c));
+  bb_list_remove(c);
+  tcache_ras_reset();
+
+  // records pending for the successors of evicted instructions
+  for (int i = 0; i < tcache_nr_bb_block; i ++) {
+    for (Decode *r = tcache_bb_block[i]; r < tcache_bb_block[i] + TCACHE_BB_SIZE; r ++) {
+      if (tcache_in_chunk(c, r->bb_src)) tcache_bb_free(r);
+    }
+  }
+
+  // only the chains going into the evicted chunk are unlinked
+  for (int i = 0; i < tc_nr_chunk; i ++) {
+    TCacheChunk *o = &tc_chunk[i];
+    if (o == c) continue;
+    for (Decode *p = o->pool; p < o->pool + o->idx; p ++) {
+      if (tcache_in_chunk(c, p->tnext))  p->tnext  = tcache_unlink(p, p->tnext, true);
+      if (tcache_has_ntnext(p) && tcache_in_chunk(c, p->ntnext)) p->ntnext = tcache_unlink(p, p->ntnext, false);
+      if (p->type == INSTR_TYPE_I) {
+        IFDEF(CONFIG_TCACHE_RAS, if (tcache_in_chunk(c, p->jrc->rnext)) p->jrc->rnext = NULL);
+        Decode **way = p->jrc->way;
+        for (int j = 0; j < ARRLEN(p->jrc->way); j ++) {
+          if (tcache_in_chunk(c, way[j])) way[j] = &tcache_jr_none;
+        }
+      }
+    }
+  }
+  c->idx = 0;
+}
+
+#ifdef CONFIG_TCACHE_SMC
+static inline bool tcache_code_dropped(Decode *s) {
+  return s != NULL && s->EHelper == g_exec_nemu_trace_redirect;
+}
+
+// the last entry of a decoded basic block or superblock
+static inline bool tcache_bb_end(Decode *p) {
+  return p->type != INSTR_TYPE_N && MUXDEF(CONFIG_TCACHE_TRACE, p->trace_dir == TRACE_DIR_NONE, true);
+}
+
+// whether the instructions from `p` to `last` or the end of the block are written
+static bool tcache_code_dirty(Decode *p, Decode *last) {
+  CodePage *cp = tcache_code_page(p);
+  for (; ; p ++, cp ++) {
+    if (pmem_code_dirty(cp->first) || pmem_code_dirty(cp->last)) return true;
+    if (p == last || tcache_bb_end(p)) return false;
+  }
+}
+
+static void tcache_bb_unlink_dropped(Decode *head) {
+  for (Decode *p = head; ; p ++) {
+    if (tcache_code_dropped(p->tnext))  p->tnext  = tcache_unlink(p, p->tnext, true);
+    if (tcache_has_ntnext(p) && tcache_code_dropped(p->ntnext)) p->ntnext = tcache_unlink(p, p->ntnext, false);
+    if (p->type == INSTR_TYPE_I) {
+      IFDEF(CONFIG_TCACHE_RAS, if (tcache_code_dropped(p->jrc->rnext)) p->jrc->rnext = NULL);
+      Decode **way = p->jrc->way;
+      for (int j = 0; j < ARRLEN(p->jrc->way); j ++) {
+        if (tcache_code_dropped(way[j])) way[j] = &tcache_jr_none;
+      }
+    }
+    if (tcache_bb_end(p)) return;
+  }
+}
+
+// Drop the basic blocks with instructions on pages written since the last
+// fence.i. Their first entries redirect to a new decoding, and the links to
+// them from the remaining blocks are undone as chunk eviction does. Only the
+// blocks in bb_list are visited, the others are not reachable any more.
+static void tcache_code_flush() {
+  tc_stat.code_flush ++;
+  for (uint32_t i = 0; i < bb_list_size; i ++) {
+    if (bb_list[i].pc == BB_EMPTY || !tcache_code_dirty(bb_list[i].s, NULL)) continue;
+    bb_list[i].s->EHelper = g_exec_nemu_trace_redirect;
+    tc_stat.code_drop ++;
+  }
+  pmem_code_clean();
+  tcache_ras_reset();
+
+  for (uint32_t i = 0; i < bb_list_size; ) {
+    // entries shifted into slot `i` have to be checked again
+    if (bb_list[i].pc != BB_EMPTY && tcache_code_dropped(bb_list[i].s)) bb_list_delete(i);
+    else i ++;
+  }
+  for (uint32_t i = 0; i < bb_list_size; i ++) {
+    if (bb_list[i].pc != BB_EMPTY) tcache_bb_unlink_dropped(bb_list[i].s);
+  }
+}
+#endif
+
+// Continue with a new chunk, or the oldest one when no more can be allocated.
+static void tcache_chunk_next() {
+  if (tc_cur == tc_nr_chunk - 1 && tc_nr_chunk < CONFIG_TCACHE_MAX_CHUNKS) {
+    TCacheChunk *c = &tc_chunk[tc_nr_chunk];
+    uint8_t *mem = aligned_alloc(TCACHE_CHUNK_ALIGN, TCACHE_CHUNK_ALIGN);
+    c->bbv_id = (uint32_t *)mem;
+    c->pool = (Decode *)(mem + TCACHE_BBV_BYTES); // 64-byte entries do not cross cache lines
+    c->jrc = malloc(sizeof(JRCache) * CONFIG_TCACHE_SIZE);
+    assert(mem != NULL && c->jrc != NULL);
+#ifdef CONFIG_TCACHE_SMC
+    c->code = malloc(sizeof(CodePage) * CONFIG_TCACHE_SIZE);
+    assert(c->code != NULL);
+#endif
+    c->idx = 0;
+    tc_cur = tc_nr_chunk ++;
+    return;
+  }
+  tc_cur = (tc_cur + 1) % tc_nr_chunk;
+  tcache_chunk_evict(&tc_chunk[tc_cur]);
+}
+
 void tcache_flush() {
-  tc_idx = 0;
-  bb_idx = 0;
-  memset(bb_list, -1, sizeof(bb_list));
+  if (tc_nr_chunk == 0) {
+    // first time
+    uint32_t size = 1;
+    while (size < CONFIG_BB_LIST_SIZE) size <<= 1;
+    bb_list_alloc(size);
+    tc_cur = -1;
+    tcache_chunk_next();
+  }
+  bb_list_remove(NULL);
+  for (int i = 0; i < tc_nr_chunk; i ++) {
+    IFDEF(CONFIG_TCACHE_JR_STAT, tcache_jr_stat_retire(&tc_chunk[i]));
+    tc_chunk[i].idx = 0;
+  }
+  tc_cur = 0;
+  tcache_ras_reset();
+  IFDEF(CONFIG_ENGINE_DBT, dbt_flush());
+  IFDEF(CONFIG_TCACHE_SMC, pmem_code_clean());
+
+  tcache_bb_freelist = NULL;
+  for (int i = 0; i < tcache_nr_bb_block; i ++) {
+    tcache_bb_block_free(tcache_bb_block[i]);
+  }
+}
 
-  int i;
-  for (i = 0; i < TCACHE_BB_SIZE - 1; i ++) {
-    tcache_bb_pool[i].list_next = &tcache_bb_pool[i + 1];
+void tcache_statistic() {
+  Log("tcache: %d chunks of %d entries, %d basic blocks in %d hash slots, flush = %'ld, evict = %'ld",
+      tc_nr_chunk, CONFIG_TCACHE_SIZE, bb_list_nr, bb_list_size, tc_stat.flush, tc_stat.evict);
+#ifdef CONFIG_TCACHE_SMC
+  Log("self-modifying code: %'ld fence.i flushed code, %'ld basic blocks dropped",
+      tc_stat.code_flush, tc_stat.code_drop);
+#endif
+  IFDEF(CONFIG_TCACHE_FUSE, Log("fused instruction pairs: %'ld", tc_stat.fuse));
+#ifdef CONFIG_TCACHE_JR_STAT
+  // the indirect jumps missing most
+  enum { NR_TOP = 8 };
+  Decode *top[NR_TOP] = {};
+  uint64_t hit = tc_stat.jr_hit, ras_hit = tc_stat.jr_ras_hit, miss = tc_stat.jr_miss;
+  for (int i = 0; i < tc_nr_chunk; i ++) {
+    for (Decode *p = tc_chunk[i].pool; p < tc_chunk[i].pool + tc_chunk[i].idx; p ++) {
+      if (p->type != INSTR_TYPE_I) continue;
+      hit += p->jrc->hit;
+      ras_hit += p->jrc->ras_hit;
+      miss += p->jrc->miss;
+      int j = NR_TOP;
+      for (; j > 0 && (top[j - 1] == NULL || top[j - 1]->jrc->miss < p->jrc->miss); j --) {
+        if (j < NR_TOP) top[j] = top[j - 1];
+      }
+      if (j < NR_TOP) top[j] = p;
+    }
   }
-  tcache_bb_pool[TCACHE_BB_SIZE - 1].list_next = NULL;
-  tcache_bb_freelist = &tcache_bb_pool[0];
+  Log("indirect jumps: %'ld, hit = %'ld, return address stack hit = %'ld, miss = %'ld",
+      hit + ras_hit + miss, hit, ras_hit, miss);
+  for (int j = 0; j < NR_TOP && top[j] != NULL; j ++) {
+    JRCache *c = top[j]->jrc;
+    Log("  pc = " FMT_WORD ": hit = %'ld, return address stack hit = %'ld, miss = %'ld",
+        top[j]->pc, c->hit, c->ras_hit, c->miss);
+  }
+#endif
+}
+
+#ifdef CONFIG_TCACHE_TRACE
+// Superblocks are formed at basic block granularity, which would change
+// the basic blocks seen by SimPoint profiling and checkpointing.
+static inline bool tcache_trace_enable() {
+  return profiling_state == NoProfiling && !checkpoint_taking;
+}
+
+// the direction to follow at a branch which has become hot, or TRACE_DIR_NONE if it is not biased enough
+static inline int tcache_trace_bias(Decode *s) {
+  if (s->trace_cnt < CONFIG_TCACHE_TRACE_HOT) return TRACE_DIR_NONE;
+  if (s->trace_taken >= CONFIG_TCACHE_TRACE_HOT - CONFIG_TCACHE_TRACE_HOT / 16) return TRACE_DIR_TAKEN;
+  if (s->trace_taken <= CONFIG_TCACHE_TRACE_HOT / 16) return TRACE_DIR_NTAKEN;
+  return TRACE_DIR_NONE;
+}
+
+// Walk the blocks from `src` along jumps and biased branches, and copy them
+// to consecutive tcache entries. Return the number of entries copied, or 0
+// if the tcache is full.
+static int tcache_trace_copy(Decode *src, Decode *dst_head) {
+  int n = 0;
+  while (true) {
+    Decode *dst = (n == 0 ? dst_head : tcache_new(src->pc));
+    if (dst == NULL) return 0;
+    assert(dst == dst_head + n);
+    *dst = *src;
+    IFDEF(CONFIG_ENGINE_DBT, dbt_restore(dst));
+    IFDEF(CONFIG_TCACHE_SMC, *tcache_code_page(dst) = *tcache_code_page(src));
+    n ++;
+    dst->idx_in_bb = n;
+    if (src->type == INSTR_TYPE_N) { src ++; continue; }
+
+    int dir = src->trace_dir;
+    if (dir != TRACE_DIR_NONE) { src ++; continue; } // already inlined in the source
+
+    dir = (src->type == INSTR_TYPE_J ? TRACE_DIR_TAKEN :
+           src->type == INSTR_TYPE_B ? tcache_trace_bias(src) : TRACE_DIR_NONE);
+    bb_t *bb = NULL;
+    if (dir != TRACE_DIR_NONE && n < CONFIG_TCACHE_TRACE_MAX_LEN) {
+      bb = bb_find(dir == TRACE_DIR_TAKEN ? isa_jnpc(src) : decode_snpc(src));
+    }
+    if (bb == NULL) {
+      // the superblock ends here, successors are linked later
+      dst->trace_dir = TRACE_DIR_NONE;
+      return n;
+    }
+    dst->trace_dir = dir;
+    src = bb->s;
+  }
+}
+
+// Called when the block-ending branch `s` has just become hot.
+void tcache_trace_form(Decode *s) {
+  if (!tcache_trace_enable() || tcache_trace_bias(s) == TRACE_DIR_NONE) return;
+  if (s->idx_in_bb >= CONFIG_TCACHE_TRACE_MAX_LEN) return;
+  Decode *old = s - (s->idx_in_bb - 1);
+  bb_t *bb = bb_find(old->pc);
+  if (bb == NULL || bb->s != old) return;
+
+  int idx = tc_chunk[tc_cur].idx;
+  Decode *sb = tcache_new(old->pc);
+  int n = (sb == NULL ? 0 : tcache_trace_copy(old, sb));
+  if (n == 0) {
+    // not enough room left in this chunk, profile again and retry in the next one
+    tc_chunk[tc_cur].idx = idx;
+    s->trace_cnt = s->trace_taken = 0;
+    return;
+  }
+
+  // bb_find() may have reordered the hash chain, look it up again
+  bb = bb_find(old->pc);
+  bb->s = sb;
+  for (Decode *p = sb; p < sb + n; p ++) {
+    if (p->type == INSTR_TYPE_N) continue;
+    switch (p->trace_dir) {
+      case TRACE_DIR_TAKEN:
+        p->tnext = p + 1;
+        if (p->type == INSTR_TYPE_B) tcache_bb_fetch(p, false, decode_snpc(p));
+        break;
+      case TRACE_DIR_NTAKEN:
+        p->ntnext = p + 1;
+        tcache_bb_fetch(p, true, isa_jnpc(p));
+        break;
+      default:
+        switch (p->type) {
+          case INSTR_TYPE_J: tcache_bb_fetch(p, true, isa_jnpc(p)); break;
+          case INSTR_TYPE_B:
+            tcache_bb_fetch(p, true, isa_jnpc(p));
+            tcache_bb_fetch(p, false, decode_snpc(p) + MUXDEF(__ISA_mips32__, 4, 0));
+            break;
+          case INSTR_TYPE_I: tcache_jr_init(p); break;
+          default: assert(0);
+        }
+    }
+  }
+  old->EHelper = g_exec_nemu_trace_redirect;
+  IFDEF(CONFIG_ENGINE_DBT, dbt_bb_new(sb));
+}
+#endif
+
+Decode* tcache_trace_redirect(Decode *s) {
+  bb_t *bb = bb_find(s->pc);
+  if (bb == NULL) return tcache_bb_new(s->pc); // dropped for self-modifying code, decode it again
+  assert(bb->s != s);
+  return bb->s;
 }
 
 enum { TCACHE_BB_BUILDING, TCACHE_RUNNING };
-static int tcache_state = TCACHE_RUNNING;
-static Decode *bb_now = NULL, *bb_now_record = NULL;
+static HART_LOCAL int tcache_state = TCACHE_RUNNING;
+static HART_LOCAL Decode *bb_now = NULL, *bb_now_record = NULL;
+
+// Make `d` the most recently used target of the indirect jump `s`, which
+// was at position `pos` of tnext and the other ways.
+static inline void tcache_jr_promote(Decode *s, Decode *d, int pos) {
+  Decode **way = s->jrc->way;
+  for (int i = pos - 1; i > 0; i --) { way[i] = way[i - 1]; }
+  if (pos >= 1) way[0] = s->tnext;
+  s->tnext = d;
+}
 
 __attribute__((noinline))
 Decode* tcache_jr_fetch(Decode *s, vaddr_t jpc) {
-  s->ntnext = s->tnext;
-  tcache_bb_fetch(s, true, jpc);
-  return s->tnext;
+  JRCache *c = s->jrc;
+  for (int i = 0; i < ARRLEN(c->way); i ++) {
+    Decode *d = c->way[i];
+    if (d->pc == jpc) {
+      IFDEF(CONFIG_TCACHE_JR_STAT, c->hit ++);
+      tcache_jr_promote(s, d, i + 1);
+      return d;
+    }
+  }
+  IFDEF(CONFIG_TCACHE_JR_STAT, c->miss ++);
+  bb_t *bb = bb_find(jpc);
+  // only decoded basic blocks are cached, since records are freed once decoded
+  if (bb == NULL) return tcache_bb_new(jpc);
+  tcache_jr_promote(s, bb->s, CONFIG_TCACHE_JR_WAYS - 1);
+  return bb->s;
 }
 
+#ifdef CONFIG_TCACHE_RAS
+// The basic block a call returns to, once it is decoded. It is cached in
+// ntnext of a direct call, and the jump cache of an indirect call.
+Decode* tcache_ras_fetch(Decode *s) {
+  bb_t *bb = bb_find(decode_snpc(s));
+  if (bb == NULL) return &tcache_jr_none;
+  if (s->type == INSTR_TYPE_J) s->ntnext = bb->s;
+  else s->jrc->rnext = bb->s;
+  return bb->s;
+}
+#endif
+
 static inline void tcache_patch_and_free(Decode *bb_record, Decode *bb) {
   Decode *src = bb_record->bb_src;
   if (bb_record->type == BB_RECORD_TYPE_TAKEN)  { src->tnext = bb; }
@@ -178,7 +681,8 @@ static inline void tcache_patch_and_free(Decode *bb_record, Decode *bb) {
 
 __attribute__((noinline))
 Decode* tcache_decode(Decode *s) {
-  static int idx_in_bb = 0;
+  static HART_LOCAL int idx_in_bb = 0;
+  IFDEF(CONFIG_TCACHE_FUSE, static HART_LOCAL int prev_idx = 0);
   vaddr_t thispc = s->pc;
 
   if (tcache_state == TCACHE_RUNNING) {  // start of a basic block
@@ -201,26 +705,41 @@ Decode* tcache_decode(Decode *s) {
 
   save_globals(s);
   s->idx_in_bb = idx_in_bb;
-  fetch_decode(s, thispc); // note that exception may happen!
+  __attribute__((unused)) int idx = fetch_decode(s, thispc); // note that exception may happen!
+  IFDEF(CONFIG_TCACHE_SMC, tcache_code_record(s));
+#ifdef CONFIG_TCACHE_FUSE
+  if (idx_in_bb > 1 && fuse_decode(s - 1, prev_idx, s, &idx)) tc_stat.fuse ++;
+  prev_idx = idx;
+#endif
 
+#ifdef CONFIG_TCACHE_TRACE
+  // decode through direct jumps
+  if (s->type == INSTR_TYPE_J && idx_in_bb < CONFIG_TCACHE_TRACE_MAX_LEN && tcache_trace_enable()) {
+    s->trace_dir = TRACE_DIR_TAKEN;
+    s->tnext = s + 1;
+    Decode *next = tcache_new(isa_jnpc(s));
+    if (next == NULL) { goto full; }
+    assert(next == s + 1);
+  } else
+#endif
   if (s->type == INSTR_TYPE_N) {
-    Decode *next = tcache_new(s->snpc);
+    Decode *next = tcache_new(decode_snpc(s));
     if (next == NULL) { goto full; }
     assert(next == s + 1);
   } else {
     // the end of the basic block
-    bb_t *ret = bb_insert(bb_now->pc, bb_now);
-    if (ret == NULL) { goto full; } // basic block list is full
+    bb_insert(bb_now->pc, bb_now);
     tcache_patch_and_free(bb_now_record, bb_now);
+    IFDEF(CONFIG_ENGINE_DBT, dbt_bb_new(bb_now));
     bb_now = bb_now_record = NULL;
 
     switch (s->type) {
-      case INSTR_TYPE_J: tcache_bb_fetch(s, true, s->jnpc); break;
+      case INSTR_TYPE_J: tcache_bb_fetch(s, true, isa_jnpc(s)); break;
       case INSTR_TYPE_B:
-        tcache_bb_fetch(s, true, s->jnpc);
-        tcache_bb_fetch(s, false, s->snpc + MUXDEF(__ISA_mips32__, 4, 0));
+        tcache_bb_fetch(s, true, isa_jnpc(s));
+        tcache_bb_fetch(s, false, decode_snpc(s) + MUXDEF(__ISA_mips32__, 4, 0));
         break;
-      case INSTR_TYPE_I: s->tnext = s->ntnext = s; break; // update dynamically
+      case INSTR_TYPE_I: tcache_jr_init(s); break; // update dynamically
       default: assert(0);
     }
     tcache_state = TCACHE_RUNNING;
@@ -230,7 +749,8 @@ Decode* tcache_decode(Decode *s) {
   return s;
 
 full:
-  tcache_flush();
+  // the current chunk is used up, and the partial basic block in it is dropped
+  tcache_chunk_next();
   s = tcache_bb_new(thispc); // decode this instruction again
   s->idx_in_bb = idx_in_bb;
   save_globals(s);
@@ -239,7 +759,7 @@ full:
   longjmp_exec(NEMU_EXEC_AGAIN);
 }
 
-static Decode ex = {};
+static HART_LOCAL Decode ex = {};
 
 void tcache_handle_exception(vaddr_t jpc) {
   tcache_bb_fetch(&ex, true, jpc);
@@ -248,14 +768,29 @@ void tcache_handle_exception(vaddr_t jpc) {
 }
 
 Decode* tcache_handle_flush(vaddr_t snpc) {
+  tc_stat.flush ++;
   tcache_flush();
   tcache_handle_exception(snpc);
   return ex.tnext;
 }
 
-Decode* tcache_init(const void *exec_nemu_decode, vaddr_t reset_vector) {
+#ifdef CONFIG_TCACHE_SMC
+// fence.i at `s` goes on with the next instruction, unless its own block is dropped
+Decode* tcache_handle_code_flush(Decode *s) {
+  bool dirty = (tcache_state == TCACHE_BB_BUILDING ? tcache_code_dirty(bb_now, s) :
+      tcache_code_dirty(s - (s->idx_in_bb - 1), NULL));
+  tcache_code_flush();
+  if (!dirty) return s + 1;
+  tcache_handle_exception(decode_snpc(s));
+  return ex.tnext;
+}
+#endif
+
+Decode* tcache_init(const void *exec_nemu_decode, const void *exec_nemu_trace_redirect,
+    vaddr_t reset_vector) {
   tcache_flush();
   g_exec_nemu_decode = exec_nemu_decode;
+  g_exec_nemu_trace_redirect = exec_nemu_trace_redirect;
   return tcache_bb_new(reset_vector);
 }
 #endif
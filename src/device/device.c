@@ -16,6 +16,7 @@
 
 #include <common.h>
 #include <utils.h>
+#include <device/map.h>
 #ifndef CONFIG_SHARE
 #include <device/alarm.h>
 #include <SDL2/SDL.h>
@@ -50,6 +51,7 @@ void device_update() {
     return;
   }
   device_update_flag = false;
+  IFDEF(CONFIG_MULTIHART, device_lock());
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
 #ifndef CONFIG_SHARE
@@ -57,7 +59,7 @@ void device_update() {
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
+        __atomic_store_n(&nemu_state.state, NEMU_QUIT, __ATOMIC_RELEASE);
         break;
 #ifdef CONFIG_HAS_KEYBOARD
       // If a key was pressed
@@ -73,6 +75,7 @@ void device_update() {
     }
   }
 #endif
+  IFDEF(CONFIG_MULTIHART, device_unlock());
 }
 
 void sdl_clear_event_queue() {
@@ -37,6 +37,8 @@ static void disk_io_handler(uint32_t offset, int len, bool is_write) {
     fseek(fp, disk_base[START] * 512, SEEK_SET);
     int ret = fread(guest_to_host(disk_base[BUF]), disk_base[COUNT] * 512l, 1, fp);
     assert(ret == 1);
+    IFDEF(CONFIG_TCACHE_SMC, pmem_code_write(disk_base[BUF], disk_base[COUNT] * 512l));
+    pmem_dirty_write(disk_base[BUF], disk_base[COUNT] * 512l);
   }
 #endif
 }
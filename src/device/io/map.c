@@ -18,6 +18,9 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
+#ifdef CONFIG_MULTIHART
+#include <pthread.h>
+#endif
 
 #define IO_SPACE_MAX (128 * 1024 * 1024)
 
@@ -43,18 +46,30 @@ static inline void invoke_callback(io_callback_t c, paddr_t offset, int len, boo
   if (c != NULL) { c(offset, len, is_write); }
 }
 
+#ifdef CONFIG_MULTIHART
+// devices are accessed by one hart at a time
+static pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
+void device_lock()   { pthread_mutex_lock(&device_mutex); }
+void device_unlock() { pthread_mutex_unlock(&device_mutex); }
+#endif
+
 word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_MULTIHART, device_lock());
   invoke_callback(map->callback, offset, len, false); // prepare data to read
-  return host_read(map->space + offset, len);
+  word_t data = host_read(map->space + offset, len);
+  IFDEF(CONFIG_MULTIHART, device_unlock());
+  return data;
 }
 
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_MULTIHART, device_lock());
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
+  IFDEF(CONFIG_MULTIHART, device_unlock());
 }
@@ -14,41 +14,122 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/vaddr.h>
 
 #define NR_MAP 16
 
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
 
+// The address ranges served by the maps, sorted by their low address, so
+// that an address is looked up with a binary search. The range found last is
+// checked first, since is_in_mmio() is followed by an access to the same map.
+// If maps overlap, the one added first keeps the shared addresses, and a
+// later map may be split into several ranges.
+typedef struct {
+  paddr_t low, high;
+  IOMap *map;
+} MMIORange;
+
+#define NR_RANGE (2 * NR_MAP)
+
+static MMIORange ranges[NR_RANGE] = {};
+static int nr_range = 0;
+static HART_LOCAL MMIORange *last_range = NULL;
+
+static inline MMIORange* fetch_mmio_range(paddr_t addr) {
+  if (likely(last_range != NULL && addr >= last_range->low && addr <= last_range->high)) {
+    return last_range;
+  }
+  int l = 0, r = nr_range - 1;
+  while (l <= r) {
+    int m = (l + r) / 2;
+    MMIORange *range = &ranges[m];
+    if (addr < range->low) r = m - 1;
+    else if (addr > range->high) l = m + 1;
+    else { last_range = range; return range; }
+  }
+  return NULL;
+}
+
 static inline IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  MMIORange *range = fetch_mmio_range(addr);
+  return (range == NULL ? NULL : range->map);
 }
 
 bool is_in_mmio(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? false : true);
+  return fetch_mmio_range(addr) != NULL;
+}
+
+// The host address backing the guest physical page of `paddr`, if the whole
+// page is in a map without callback. Accesses to such a page have no side
+// effect, so that the host TLB may map it directly, like pmem.
+uint8_t* mmio_plain_page(paddr_t paddr) {
+  paddr_t page = paddr & ~(paddr_t)PAGE_MASK;
+  MMIORange *range = fetch_mmio_range(paddr);
+  if (range == NULL || range->map->callback != NULL) return NULL;
+  if (page < range->low || page + PAGE_SIZE - 1 > range->high) return NULL;
+  return (uint8_t *)range->map->space + (page - range->map->low);
+}
+
+static void add_mmio_range(paddr_t low, paddr_t high, IOMap *map) {
+  assert(nr_range < NR_RANGE);
+  int i;
+  for (i = 0; i < nr_range && ranges[i].high < low; i ++);
+  memmove(&ranges[i + 1], &ranges[i], sizeof(ranges[0]) * (nr_range - i));
+  ranges[i] = (MMIORange){ .low = low, .high = high, .map = map };
+  nr_range ++;
+  last_range = NULL;
 }
 
 /* device interface */
 void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
   assert(nr_map < NR_MAP);
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
+  IOMap *map = &maps[nr_map];
+  *map = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
     .space = space, .callback = callback };
   Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
+      map->name, map->low, map->high);
   fflush(stdout);
 
   nr_map ++;
+
+  // the addresses of the new map not taken by the maps added before
+  paddr_t gap_low[NR_RANGE + 1], gap_high[NR_RANGE + 1];
+  int nr_gap = 0;
+  paddr_t low = map->low;
+  bool covered = false;
+  for (int i = 0; i < nr_range && !covered; i ++) {
+    MMIORange *range = &ranges[i];
+    if (range->high < low) continue;
+    if (range->low > map->high) break;
+    Log("Mmio map '%s' overlaps with '%s', which keeps the shared addresses",
+        map->name, range->map->name);
+    if (range->low > low) {
+      gap_low[nr_gap] = low;
+      gap_high[nr_gap ++] = range->low - 1;
+    }
+    if (range->high >= map->high) covered = true;
+    else low = range->high + 1;
+  }
+  if (!covered) {
+    gap_low[nr_gap] = low;
+    gap_high[nr_gap ++] = map->high;
+  }
+  for (int i = 0; i < nr_gap; i ++) {
+    add_mmio_range(gap_low[i], gap_high[i], map);
+  }
 }
 
 /* bus interface */
 __attribute__((noinline))
 word_t mmio_read(paddr_t addr, int len) {
+  difftest_skip_ref();
   return map_read(addr, len, fetch_mmio_map(addr));
 }
 
 __attribute__((noinline))
 void mmio_write(paddr_t addr, int len, word_t data) {
+  difftest_skip_ref();
   map_write(addr, len, data, fetch_mmio_map(addr));
 }
@@ -0,0 +1,405 @@
+/***************************************************************************************
+* Copyright (c) 2014-2021 Zihao Yu, Nanjing University
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/cpu.h>
+#include <cpu/dbt.h>
+#include <rtl/rtl.h>
+#include <memory/vaddr.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "x86.h"
+
+#ifndef __x86_64__
+#error "the DBT engine only emits x86-64 host code"
+#endif
+
+// A basic block is first profiled, and translated once it becomes hot. The
+// header of its profile, and of each run of translated instructions in it,
+// lives in the code cache, followed by the host code of the run. The host
+// code keeps &cpu in rbx and the first instruction of the run in rbp. Each
+// instruction loads its operands from and stores its result to the guest
+// registers in memory, so the state is always up to date when a helper
+// raises an exception with longjmp().
+typedef struct {
+  Decode *s;            // the first instruction of the run
+  const void *EHelper;  // the EHelper of `s` replaced by exec_nemu_dbt
+  uint32_t size;        // including the header
+  uint32_t cnt;         // executions of the profiled block
+} DBTHeader;
+
+// enough for the host code of an instruction and the exit after it
+#define DBT_INSTR_MAX 128
+// entering host code costs about as much as interpreting a dozen
+// instructions, mostly for the indirect call that is hardly predictable
+#define DBT_RUN_MIN 12
+
+static uint8_t *dbt_buf = NULL;
+static const void *g_exec_nemu_dbt = NULL;
+static const void *g_exec_nemu_dbt_profile = NULL;
+// the first instruction of the run being translated
+static Decode *dbt_start = NULL;
+
+// EHelpers are mapped back to the indices of their instructions with an
+// open addressing hash table. The compiler may merge the labels of EHelpers
+// with the same code, in which case either index translates to the same.
+typedef struct {
+  const void *EHelper;
+  int idx;
+} DBTIdx;
+static DBTIdx *dbt_idx_map = NULL;
+static uint32_t dbt_idx_mask = 0;
+
+static struct {
+  uint64_t bb, run, instr, flush;
+} dbt_stat = {};
+
+static inline uint32_t dbt_idx_hash(const void *EHelper) {
+  return ((uintptr_t)EHelper * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+static int dbt_idx(const void *EHelper) {
+  for (uint32_t i = dbt_idx_hash(EHelper); ; i ++) {
+    DBTIdx *e = &dbt_idx_map[i & dbt_idx_mask];
+    if (e->EHelper == EHelper) return e->idx;
+    if (e->EHelper == NULL) return -1;
+  }
+}
+
+static inline bool dbt_room() {
+  return dbt_buf + CONFIG_DBT_CODE_SIZE - x86_code >= DBT_INSTR_MAX;
+}
+
+// the guest registers are addressed from rbx
+static inline bool dbt_in_cpu(const void *p) {
+  return (uintptr_t)p - (uintptr_t)&cpu < sizeof(cpu);
+}
+
+static inline int32_t dbt_cpu_disp(const void *p) {
+  return (uint8_t *)p - (uint8_t *)&cpu;
+}
+
+static void dbt_load(int reg, const rtlreg_t *p) {
+  if (p == rz) { x86_zero(reg); return; }
+  if (dbt_in_cpu(p)) { x86_load(reg, X86_RBX, dbt_cpu_disp(p)); return; }
+  x86_li(reg, (uintptr_t)p);
+  x86_load(reg, reg, 0);
+}
+
+static void dbt_store(rtlreg_t *p, int reg) {
+  if (dbt_in_cpu(p)) { x86_store(X86_RBX, dbt_cpu_disp(p), reg); return; }
+  x86_li(X86_R11, (uintptr_t)p);
+  x86_store(X86_R11, 0, reg);
+}
+
+static inline void dbt_call_host(const void *fn) {
+  x86_li(X86_RAX, (uintptr_t)fn);
+  x86_call(X86_RAX);
+}
+
+// reg = s
+static inline void dbt_decode(int reg, Decode *s) {
+  x86_lea(reg, X86_RBP, (uint8_t *)s - (uint8_t *)dbt_start);
+}
+
+// leave the host code, and let the interpreter go on with `s`
+static void dbt_exit(Decode *s) {
+  dbt_decode(X86_RAX, s);
+  x86_pop(X86_RCX);
+  x86_pop(X86_RBP);
+  x86_pop(X86_RBX);
+  x86_ret();
+}
+
+static inline bool dbt_op_is_w(int op) {
+  return op >= DBT_ADDW;
+}
+
+// rax = rax op rcx
+static void dbt_op(int op) {
+  int w = !dbt_op_is_w(op);
+  switch (op) {
+    case DBT_ADD: case DBT_ADDW: x86_alu(w, X86_ADD, X86_RAX, X86_RCX); break;
+    case DBT_SUB: case DBT_SUBW: x86_alu(w, X86_SUB, X86_RAX, X86_RCX); break;
+    case DBT_AND: x86_alu(w, X86_AND, X86_RAX, X86_RCX); break;
+    case DBT_OR:  x86_alu(w, X86_OR,  X86_RAX, X86_RCX); break;
+    case DBT_XOR: x86_alu(w, X86_XOR, X86_RAX, X86_RCX); break;
+    // the shift amount in cl is masked just as c_shl() and c_shlw() do
+    case DBT_SHL: case DBT_SHLW: x86_shift(w, X86_SHL, X86_RAX); break;
+    case DBT_SHR: case DBT_SHRW: x86_shift(w, X86_SHR, X86_RAX); break;
+    case DBT_SAR: case DBT_SARW: x86_shift(w, X86_SAR, X86_RAX); break;
+    case DBT_MUL: case DBT_MULW: x86_imul(1, X86_RAX, X86_RCX); break;
+    default: panic("unsupported op = %d", op);
+  }
+  if (!w) x86_sext(X86_RAX, X86_RAX, 4);
+}
+
+void dbt_alu(int op, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2) {
+  dbt_load(X86_RAX, src1);
+  dbt_load(X86_RCX, src2);
+  dbt_op(op);
+  dbt_store(dest, X86_RAX);
+}
+
+void dbt_alui(int op, rtlreg_t *dest, const rtlreg_t *src1, sword_t imm) {
+  int w = !dbt_op_is_w(op);
+  dbt_load(X86_RAX, src1);
+  switch (op) {
+    case DBT_SHL: case DBT_SHLW: x86_shifti(w, X86_SHL, X86_RAX, imm & (w ? 0x3f : 0x1f)); break;
+    case DBT_SHR: case DBT_SHRW: x86_shifti(w, X86_SHR, X86_RAX, imm & (w ? 0x3f : 0x1f)); break;
+    case DBT_SAR: case DBT_SARW: x86_shifti(w, X86_SAR, X86_RAX, imm & (w ? 0x3f : 0x1f)); break;
+    case DBT_ADD: case DBT_ADDW: case DBT_SUB: case DBT_SUBW:
+    case DBT_AND: case DBT_OR: case DBT_XOR:
+      if (imm == (int32_t)imm) {
+        if (imm == 0 && (op == DBT_ADD || op == DBT_SUB)) break; // mv
+        static const int x86_op[] = {
+          [DBT_ADD] = X86_ADD, [DBT_SUB] = X86_SUB, [DBT_AND] = X86_AND, [DBT_OR] = X86_OR,
+          [DBT_XOR] = X86_XOR, [DBT_ADDW] = X86_ADD, [DBT_SUBW] = X86_SUB,
+        };
+        x86_alui(w, x86_op[op], X86_RAX, imm);
+        break;
+      }
+      // fall through
+    default:
+      x86_li(X86_RCX, imm);
+      dbt_op(op);
+      dbt_store(dest, X86_RAX);
+      return;
+  }
+  if (!w) x86_sext(X86_RAX, X86_RAX, 4);
+  dbt_store(dest, X86_RAX);
+}
+
+static int dbt_relop_cc(uint32_t relop) {
+  switch (relop) {
+    case RELOP_EQ:  return X86_CC_E;
+    case RELOP_NE:  return X86_CC_NE;
+    case RELOP_LT:  return X86_CC_L;
+    case RELOP_LE:  return X86_CC_LE;
+    case RELOP_GT:  return X86_CC_G;
+    case RELOP_GE:  return X86_CC_GE;
+    case RELOP_LTU: return X86_CC_B;
+    case RELOP_LEU: return X86_CC_BE;
+    case RELOP_GTU: return X86_CC_A;
+    case RELOP_GEU: return X86_CC_AE;
+    default: panic("unsupported relop = %d", relop);
+  }
+}
+
+void dbt_setrelop(uint32_t relop, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2) {
+  if (relop == RELOP_FALSE || relop == RELOP_TRUE) { dbt_li(dest, relop == RELOP_TRUE); return; }
+  dbt_load(X86_RAX, src1);
+  dbt_load(X86_RCX, src2);
+  x86_alu(1, X86_CMP, X86_RAX, X86_RCX);
+  x86_setcc_rax(dbt_relop_cc(relop));
+  dbt_store(dest, X86_RAX);
+}
+
+void dbt_setrelopi(uint32_t relop, rtlreg_t *dest, const rtlreg_t *src1, sword_t imm) {
+  if (relop == RELOP_FALSE || relop == RELOP_TRUE) { dbt_li(dest, relop == RELOP_TRUE); return; }
+  dbt_load(X86_RAX, src1);
+  if (imm == (int32_t)imm) x86_alui(1, X86_CMP, X86_RAX, imm);
+  else {
+    x86_li(X86_RCX, imm);
+    x86_alu(1, X86_CMP, X86_RAX, X86_RCX);
+  }
+  x86_setcc_rax(dbt_relop_cc(relop));
+  dbt_store(dest, X86_RAX);
+}
+
+void dbt_li(rtlreg_t *dest, rtlreg_t imm) {
+  if (dbt_in_cpu(dest) && (sword_t)imm == (int32_t)imm) {
+    // mov qword [rbx + disp], imm
+    x86_rm(1, 0xc7, 0, X86_RBX, dbt_cpu_disp(dest));
+    x86_imm32(imm);
+    return;
+  }
+  x86_li(X86_RAX, imm);
+  dbt_store(dest, X86_RAX);
+}
+
+// rsi = *addr + offset
+static void dbt_addr(const rtlreg_t *addr, word_t offset) {
+  dbt_load(X86_RSI, addr);
+  if ((sword_t)offset == (int32_t)offset) {
+    if (offset != 0) x86_alui(1, X86_ADD, X86_RSI, offset);
+  } else {
+    x86_li(X86_RAX, offset);
+    x86_alu(1, X86_ADD, X86_RSI, X86_RAX);
+  }
+}
+
+void dbt_lm(Decode *s, rtlreg_t *dest, const rtlreg_t *addr, word_t offset, int len, int mmu_mode, bool sign) {
+  dbt_addr(addr, offset);
+  dbt_decode(X86_RDI, s);
+  x86_li(X86_RDX, len);
+  x86_li(X86_RCX, mmu_mode);
+  dbt_call_host(vaddr_read);
+  if (sign && len < 8) x86_sext(X86_RAX, X86_RAX, len);
+  dbt_store(dest, X86_RAX);
+}
+
+void dbt_sm(Decode *s, const rtlreg_t *src1, const rtlreg_t *addr, word_t offset, int len, int mmu_mode) {
+  dbt_addr(addr, offset);
+  dbt_load(X86_RCX, src1);
+  dbt_decode(X86_RDI, s);
+  x86_li(X86_RDX, len);
+  x86_li(X86_R8, mmu_mode);
+  dbt_call_host(vaddr_write);
+}
+
+void dbt_jrelop(Decode *s, uint32_t relop, const rtlreg_t *src1, const rtlreg_t *src2) {
+#ifdef CONFIG_TCACHE_TRACE
+  bool taken = (s->trace_dir == TRACE_DIR_TAKEN);
+  if (relop == RELOP_FALSE || relop == RELOP_TRUE) {
+    if ((relop == RELOP_TRUE) != taken) dbt_exit(s);
+    return;
+  }
+  dbt_load(X86_RAX, src1);
+  dbt_load(X86_RCX, src2);
+  x86_alu(1, X86_CMP, X86_RAX, X86_RCX);
+  int cc = dbt_relop_cc(relop);
+  // skip the exit when going the inlined direction
+  uint8_t *j = x86_jcc(taken ? cc : cc ^ 1);
+  dbt_exit(s);
+  x86_jcc_here(j);
+#else
+  panic("branches are only translated inside superblocks");
+#endif
+}
+
+void dbt_call(Decode *s, void (*ehelper)(Decode *)) {
+  dbt_decode(X86_RDI, s);
+  dbt_call_host(ehelper);
+}
+
+// the last instruction of a basic block or superblock
+static inline bool dbt_bb_end(Decode *p) {
+  return p->type != INSTR_TYPE_N && MUXDEF(CONFIG_TCACHE_TRACE, p->trace_dir == TRACE_DIR_NONE, true);
+}
+
+// Translate the runs of instructions in the basic block or superblock
+// starting at `head`. The instructions isa_dbt_translate() declines, and
+// the one ending the block, are left to the interpreter.
+void dbt_translate(Decode *head) {
+  if (!dbt_room()) {
+    dbt_flush();
+    dbt_stat.flush ++;
+  }
+  for (Decode *p = head; ; p ++) {
+    // native shares its space with ntnext and jrc, so runs start at INSTR_TYPE_N
+    if (p->type != INSTR_TYPE_N) {
+      if (dbt_bb_end(p)) return;
+      continue;
+    }
+    DBTHeader *h = (DBTHeader *)x86_code;
+    Decode *start = p;
+    x86_code = (uint8_t *)(h + 1);
+    dbt_start = start;
+    // the pushes also keep the stack aligned for calls
+    x86_push(X86_RBX);
+    x86_push(X86_RBP);
+    x86_push(X86_RAX);
+    x86_mov(X86_RBX, X86_RDI);
+    x86_mov(X86_RBP, X86_RSI);
+    for (; !dbt_bb_end(p) && dbt_room(); p ++) {
+      int idx = dbt_idx(p->EHelper);
+      if (idx < 0 || !isa_dbt_translate(p, idx)) break;
+    }
+
+    if (p - start >= DBT_RUN_MIN) {
+      dbt_exit(p);
+      x86_code = (uint8_t *)ROUNDUP((uintptr_t)x86_code, sizeof(void *));
+      *h = (DBTHeader) { .s = start, .EHelper = start->EHelper, .size = x86_code - (uint8_t *)h };
+      start->native = h + 1;
+      start->EHelper = g_exec_nemu_dbt;
+      dbt_stat.run ++;
+      dbt_stat.instr += p - start;
+    } else {
+      x86_code = (uint8_t *)h;
+    }
+    if (dbt_bb_end(p) || !dbt_room()) return;
+  }
+}
+
+// The profile is kept in the first INSTR_TYPE_N entry, since native shares
+// its space with ntnext and jrc. A superblock formed at a block-ending branch
+// thus starts its first run right after that branch.
+void dbt_bb_new(Decode *head) {
+  for (; head->type != INSTR_TYPE_N; head ++) {
+    if (dbt_bb_end(head)) return;
+  }
+  if (!dbt_room()) {
+    dbt_flush();
+    dbt_stat.flush ++;
+  }
+  DBTHeader *h = (DBTHeader *)x86_code;
+  *h = (DBTHeader) { .s = head, .EHelper = head->EHelper, .size = sizeof(*h), .cnt = 0 };
+  x86_code = (uint8_t *)(h + 1);
+  head->native = h + 1;
+  head->EHelper = g_exec_nemu_dbt_profile;
+  dbt_stat.bb ++;
+}
+
+const void* dbt_profile(Decode *s) {
+  DBTHeader *h = (DBTHeader *)s->native - 1;
+  if (++ h->cnt < CONFIG_DBT_HOT) return h->EHelper;
+  s->EHelper = h->EHelper;
+  dbt_translate(s);
+  return s->EHelper;
+}
+
+void dbt_restore(Decode *s) {
+  if (s->EHelper == g_exec_nemu_dbt || s->EHelper == g_exec_nemu_dbt_profile) {
+    s->EHelper = ((DBTHeader *)s->native - 1)->EHelper;
+  }
+}
+
+// Drop all host code. The instructions still running it go back to their own EHelpers.
+void dbt_flush() {
+  DBTHeader *h;
+  for (uint8_t *p = dbt_buf; p < x86_code; p += h->size) {
+    h = (DBTHeader *)p;
+    if (h->s->native == h + 1) dbt_restore(h->s);
+  }
+  x86_code = dbt_buf;
+}
+
+void dbt_statistic() {
+  Log("dbt: %'ld basic blocks profiled, %'ld runs of %'ld instructions translated, "
+      "%'ld code cache flushes", dbt_stat.bb, dbt_stat.run, dbt_stat.instr, dbt_stat.flush);
+}
+
+void dbt_init(const void *exec_nemu_dbt, const void *exec_nemu_dbt_profile,
+    const void **exec_table, int nr_exec) {
+  g_exec_nemu_dbt = exec_nemu_dbt;
+  g_exec_nemu_dbt_profile = exec_nemu_dbt_profile;
+  dbt_buf = mmap(NULL, CONFIG_DBT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(dbt_buf != MAP_FAILED);
+  x86_code = dbt_buf;
+
+  uint32_t size = 1;
+  while (size < nr_exec * 2) size <<= 1;
+  dbt_idx_map = calloc(size, sizeof(DBTIdx));
+  assert(dbt_idx_map != NULL);
+  dbt_idx_mask = size - 1;
+  for (int i = 0; i < nr_exec; i ++) {
+    uint32_t j = dbt_idx_hash(exec_table[i]);
+    while (dbt_idx_map[j & dbt_idx_mask].EHelper != NULL &&
+        dbt_idx_map[j & dbt_idx_mask].EHelper != exec_table[i]) j ++;
+    dbt_idx_map[j & dbt_idx_mask] = (DBTIdx){ .EHelper = exec_table[i], .idx = i };
+  }
+}
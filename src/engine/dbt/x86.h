@@ -0,0 +1,160 @@
+/***************************************************************************************
+* Copyright (c) 2014-2021 Zihao Yu, Nanjing University
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DBT_X86_H__
+#define __DBT_X86_H__
+
+#include <common.h>
+
+enum {
+  X86_RAX, X86_RCX, X86_RDX, X86_RBX, X86_RSP, X86_RBP, X86_RSI, X86_RDI,
+  X86_R8, X86_R9, X86_R10, X86_R11,
+};
+
+// condition codes of jcc and setcc, flipping the lowest bit negates them
+enum {
+  X86_CC_B = 0x2, X86_CC_AE, X86_CC_E, X86_CC_NE, X86_CC_BE, X86_CC_A,
+  X86_CC_L = 0xc, X86_CC_GE, X86_CC_LE, X86_CC_G,
+};
+
+// the /digit in the ModRM byte of group 1 and group 2 instructions
+enum { X86_ADD = 0, X86_OR = 1, X86_AND = 4, X86_SUB = 5, X86_XOR = 6, X86_CMP = 7 };
+enum { X86_SHL = 4, X86_SHR = 5, X86_SAR = 7 };
+
+// where the next byte of host code is emitted
+static uint8_t *x86_code = NULL;
+
+static inline void x86_byte(uint8_t b) { *x86_code ++ = b; }
+static inline void x86_imm32(uint32_t imm) { memcpy(x86_code, &imm, 4); x86_code += 4; }
+static inline void x86_imm64(uint64_t imm) { memcpy(x86_code, &imm, 8); x86_code += 8; }
+
+// `w` selects 64-bit operands, `reg` and `rm` are the registers in the ModRM byte
+static inline void x86_rex(int w, int reg, int rm) {
+  uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40) x86_byte(rex);
+}
+
+static inline void x86_modrm(int mod, int reg, int rm) {
+  x86_byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// `op` with register operands
+static inline void x86_rr(int w, uint8_t op, int reg, int rm) {
+  x86_rex(w, reg, rm);
+  x86_byte(op);
+  x86_modrm(3, reg, rm);
+}
+
+// `op` with the memory operand [base + disp], base can not be rsp or r12
+static inline void x86_rm(int w, uint8_t op, int reg, int base, int32_t disp) {
+  x86_rex(w, reg, base);
+  x86_byte(op);
+  if (disp == (int8_t)disp) { x86_modrm(1, reg, base); x86_byte(disp); }
+  else { x86_modrm(2, reg, base); x86_imm32(disp); }
+}
+
+// mov reg, [base + disp]
+static inline void x86_load(int reg, int base, int32_t disp) { x86_rm(1, 0x8b, reg, base, disp); }
+// mov [base + disp], reg
+static inline void x86_store(int base, int32_t disp, int reg) { x86_rm(1, 0x89, reg, base, disp); }
+
+// mov reg, imm
+static inline void x86_li(int reg, uint64_t imm) {
+  if (imm == (uint32_t)imm) {
+    x86_rex(0, 0, reg);
+    x86_byte(0xb8 + (reg & 7));
+    x86_imm32(imm);
+  } else if ((int64_t)imm == (int32_t)imm) {
+    x86_rr(1, 0xc7, 0, reg);
+    x86_imm32(imm);
+  } else {
+    x86_rex(1, 0, reg);
+    x86_byte(0xb8 + (reg & 7));
+    x86_imm64(imm);
+  }
+}
+
+// mov dst, src
+static inline void x86_mov(int dst, int src) { x86_rr(1, 0x89, src, dst); }
+// xor reg, reg
+static inline void x86_zero(int reg) { x86_rr(0, 0x31, reg, reg); }
+
+// add, or, and, sub, xor or cmp dst, src
+static inline void x86_alu(int w, int op, int dst, int src) { x86_rr(w, (op << 3) | 0x1, src, dst); }
+
+// add, or, and, sub, xor or cmp dst, imm
+static inline void x86_alui(int w, int op, int dst, int32_t imm) {
+  if (imm == (int8_t)imm) { x86_rr(w, 0x83, op, dst); x86_byte(imm); }
+  else { x86_rr(w, 0x81, op, dst); x86_imm32(imm); }
+}
+
+// shl, shr or sar dst, cl
+static inline void x86_shift(int w, int op, int dst) { x86_rr(w, 0xd3, op, dst); }
+
+// shl, shr or sar dst, imm
+static inline void x86_shifti(int w, int op, int dst, int imm) {
+  x86_rr(w, 0xc1, op, dst);
+  x86_byte(imm);
+}
+
+// imul dst, src
+static inline void x86_imul(int w, int dst, int src) {
+  x86_rex(w, dst, src);
+  x86_byte(0x0f);
+  x86_byte(0xaf);
+  x86_modrm(3, dst, src);
+}
+
+// sign-extend the lowest `len` bytes of src to dst
+static inline void x86_sext(int dst, int src, int len) {
+  switch (len) {
+    case 4: x86_rr(1, 0x63, dst, src); return;
+    case 1: x86_rex(1, dst, src); x86_byte(0x0f); x86_byte(0xbe); x86_modrm(3, dst, src); return;
+    case 2: x86_rex(1, dst, src); x86_byte(0x0f); x86_byte(0xbf); x86_modrm(3, dst, src); return;
+  }
+}
+
+// setcc al, movzx eax, al
+static inline void x86_setcc_rax(int cc) {
+  x86_byte(0x0f); x86_byte(0x90 + cc); x86_modrm(3, 0, X86_RAX);
+  x86_byte(0x0f); x86_byte(0xb6); x86_modrm(3, X86_RAX, X86_RAX);
+}
+
+// jcc rel8, with the displacement patched by x86_jcc_here()
+static inline uint8_t* x86_jcc(int cc) {
+  x86_byte(0x70 + cc);
+  x86_byte(0);
+  return x86_code;
+}
+
+static inline void x86_jcc_here(uint8_t *after_jcc) {
+  int disp = x86_code - after_jcc;
+  assert(disp <= INT8_MAX);
+  after_jcc[-1] = disp;
+}
+
+// call reg
+static inline void x86_call(int reg) { x86_rr(0, 0xff, 2, reg); }
+
+// lea reg, [base + disp]
+static inline void x86_lea(int reg, int base, int32_t disp) { x86_rm(1, 0x8d, reg, base, disp); }
+
+// push or pop one of rax to rdi
+static inline void x86_push(int reg) { x86_byte(0x50 + reg); }
+static inline void x86_pop(int reg) { x86_byte(0x58 + reg); }
+static inline void x86_ret() { x86_byte(0xc3); }
+
+#endif
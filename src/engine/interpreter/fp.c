@@ -46,7 +46,7 @@ def_rtl(fpcall, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2, uint
   uint32_t op = FPCALL_OP(cmd);
   isa_fp_csr_check();
   if (op < FPCALL_NEED_RM) {
-    static uint32_t last_rm = -1;
+    static HART_LOCAL uint32_t last_rm = -1;
     uint32_t rm = isa_fp_get_rm(s);
     if (unlikely(rm != last_rm)) {
       fp_set_rm(rm);
@@ -25,9 +25,9 @@ uint32_t pio_read(ioaddr_t addr, int len);
 void pio_write(ioaddr_t addr, int len, uint32_t data);
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret) {
-  nemu_state.state = state;
   nemu_state.halt_pc = pc;
   nemu_state.halt_ret = halt_ret;
+  __atomic_store_n(&nemu_state.state, state, __ATOMIC_RELEASE);
 }
 
 static inline void invalid_instr(vaddr_t thispc) {
@@ -206,9 +206,14 @@ static inline def_rtl(j, vaddr_t target) {
 
   cpu.pc = target;
 
+#ifndef CONFIG_PERF_OPT
+  // with CONFIG_PERF_OPT, blocks are counted at the end of each tcache block
+#ifndef CONFIG_PERF_OPT
   if (profiling_state == SimpointProfiling && profiling_started) {
     simpoint_profiling(cpu.pc, true, get_abs_instr_count());
   }
+#endif
+#endif
 
 #ifdef CONFIG_GUIDED_EXEC
 end_of_rtl_j:
@@ -231,9 +236,11 @@ static inline def_rtl(jr, rtlreg_t *target) {
 
   cpu.pc = *target;
 
+#ifndef CONFIG_PERF_OPT
   if (profiling_state == SimpointProfiling && profiling_started) {
     simpoint_profiling(cpu.pc, true, get_abs_instr_count());
   }
+#endif
 
 #ifdef CONFIG_GUIDED_EXEC
 end_of_rtl_jr:
@@ -244,7 +251,7 @@ end_of_rtl_jr:
 static inline def_rtl(jrelop, uint32_t relop,
     const rtlreg_t *src1, const rtlreg_t *src2, vaddr_t target) {
   bool is_jmp = interpret_relop(relop, *src1, *src2);
-  rtl_j(s, (is_jmp ? target : s->snpc));
+  rtl_j(s, (is_jmp ? target : decode_snpc(s)));
 }
 
 static inline def_rtl(priv_jr, rtlreg_t *target) {
@@ -262,9 +269,11 @@ static inline def_rtl(priv_jr, rtlreg_t *target) {
 
   cpu.pc = *target;
 
+#ifndef CONFIG_PERF_OPT
   if (profiling_state == SimpointProfiling && profiling_started) {
     simpoint_profiling(cpu.pc, true, get_abs_instr_count());
   }
+#endif
 
 #ifdef CONFIG_GUIDED_EXEC
 end_of_rtl_priv_jr:
@@ -93,6 +93,8 @@ typedef struct {
 } mips32_ISADecodeInfo;
 
 #define isa_mmu_state() (MMU_DYNAMIC)
+// direct jumps and branches keep their targets in dest
+#define isa_jnpc(s) ((s)->dest.imm)
 #ifdef __ICS_EXPORT
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
 #else
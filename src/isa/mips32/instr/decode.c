@@ -207,19 +207,21 @@ def_THelper(main) {
 }
 
 int isa_fetch_decode(Decode *s) {
-  s->isa.instr.val = instr_fetch(&s->snpc, 4);
+  vaddr_t snpc = s->pc;
+  s->isa.instr.val = instr_fetch(&snpc, 4);
+  s->ilen = 4;
   int idx = table_main(s);
 
   s->type = INSTR_TYPE_N;
   switch (idx) {
     case EXEC_ID_j:
-    case EXEC_ID_jal: s->jnpc = id_dest->imm; s->type = INSTR_TYPE_J; break;
+    case EXEC_ID_jal: s->type = INSTR_TYPE_J; break;
     case EXEC_ID_beq:
     case EXEC_ID_bne:
     case EXEC_ID_blez:
     case EXEC_ID_bltz:
     case EXEC_ID_bgez:
-    case EXEC_ID_bgtz: s->jnpc = id_dest->imm; s->type = INSTR_TYPE_B; break;
+    case EXEC_ID_bgtz: s->type = INSTR_TYPE_B; break;
     case EXEC_ID_ret:
     case EXEC_ID_jr:
     case EXEC_ID_jalr: s->type = INSTR_TYPE_I;
@@ -127,4 +127,7 @@ typedef struct {
 #endif
 #define isa_mmu_check(vaddr, len, type) isa_mmu_state()
 
+// direct jumps keep their targets in src1, and branches in dest
+#define isa_jnpc(s) ((s)->type == INSTR_TYPE_B ? (s)->dest.imm : (s)->src1.imm)
+
 #endif
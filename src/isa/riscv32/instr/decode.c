@@ -66,7 +66,7 @@ static inline def_DHelper(J) {
     (s->isa.instr.j.imm11 << 11) | (s->isa.instr.j.imm10_1 << 1);
   decode_op_i(s, id_src1, s->pc + offset, true);
   decode_op_r(s, id_dest, s->isa.instr.j.rd, false);
-  id_src2->imm = s->snpc;
+  id_src2->imm = decode_snpc(s);
 }
 
 static inline def_DHelper(B) {
@@ -261,7 +261,9 @@ def_THelper(main) {
 };
 
 int isa_fetch_decode(Decode *s) {
-  s->isa.instr.val = instr_fetch(&s->snpc, 4);
+  vaddr_t snpc = s->pc;
+  s->isa.instr.val = instr_fetch(&snpc, 4);
+  s->ilen = 4;
   int idx = EXEC_ID_inv;
   if (s->isa.instr.i.opcode1_0 == 0x3) {
     idx = table_main(s);
@@ -270,13 +272,13 @@ int isa_fetch_decode(Decode *s) {
   s->type = INSTR_TYPE_N;
   switch (idx) {
     case EXEC_ID_c_j: case EXEC_ID_c_jal: case EXEC_ID_jal:
-      s->jnpc = id_src1->imm; s->type = INSTR_TYPE_J; break;
+      s->type = INSTR_TYPE_J; break;
 
     case EXEC_ID_beq: case EXEC_ID_bne: case EXEC_ID_blt: case EXEC_ID_bge:
     case EXEC_ID_bltu: case EXEC_ID_bgeu:
     case EXEC_ID_c_beqz: case EXEC_ID_c_bnez:
     case EXEC_ID_p_bltz: case EXEC_ID_p_bgez: case EXEC_ID_p_blez: case EXEC_ID_p_bgtz:
-      s->jnpc = id_dest->imm; s->type = INSTR_TYPE_B; break;
+      s->type = INSTR_TYPE_B; break;
 
     case EXEC_ID_p_ret: case EXEC_ID_c_jr: case EXEC_ID_jalr:
       s->type = INSTR_TYPE_I;
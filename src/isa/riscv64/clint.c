@@ -19,6 +19,7 @@
 #include "local-include/csr.h"
 
 #ifndef CONFIG_SHARE
+#define CLINT_MSIP     0x0000 // one 32-bit register per hart
 #define CLINT_MTIMECMP (0x4000 / sizeof(clint_base[0]))
 #define CLINT_MTIME    (0xBFF8 / sizeof(clint_base[0]))
 #define TIMEBASE 10000000ul
@@ -26,14 +27,32 @@
 static uint64_t *clint_base = NULL;
 static uint64_t boot_time = 0;
 
+static inline void clint_set_mtime(uint64_t mtime) {
+#ifdef CONFIG_MULTIHART
+  // every hart updates it, and it should never go backwards
+  uint64_t old = __atomic_load_n(&clint_base[CLINT_MTIME], __ATOMIC_RELAXED);
+  while (old < mtime && !__atomic_compare_exchange_n(&clint_base[CLINT_MTIME], &old, mtime,
+        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+  clint_base[CLINT_MTIME] = mtime;
+#endif
+}
+
+// Interrupts of the hart running on the calling thread are updated. The
+// ones of other harts are picked up by themselves in isa_poll_intr().
 void update_clint() {
 #ifdef CONFIG_DETERMINISTIC
   clint_base[CLINT_MTIME] += TIMEBASE / 10000;
 #else
   uint64_t now = get_time() - boot_time;
-  clint_base[CLINT_MTIME] = TIMEBASE * now / 1000000;
+  clint_set_mtime(TIMEBASE * now / 1000000);
+#endif
+  int hart = mhartid->val;
+  mip->mtip = (clint_base[CLINT_MTIME] >= clint_base[CLINT_MTIMECMP + hart]);
+#ifdef CONFIG_MULTIHART
+  uint32_t *msip = (uint32_t *)((uint8_t *)clint_base + CLINT_MSIP);
+  mip->msip = msip[hart] & 1;
 #endif
-  mip->mtip = (clint_base[CLINT_MTIME] >= clint_base[CLINT_MTIMECMP]);
 }
 
 uint64_t clint_uptime() {
@@ -45,6 +64,12 @@ static void clint_io_handler(uint32_t offset, int len, bool is_write) {
   update_clint();
 }
 
+#ifdef CONFIG_MULTIHART
+void isa_poll_intr() {
+  update_clint();
+}
+#endif
+
 void init_clint() {
   clint_base = (uint64_t *)new_space(0x10000);
   add_mmio_map("clint", CONFIG_CLINT_MMIO, (uint8_t *)clint_base, 0x10000, clint_io_handler);
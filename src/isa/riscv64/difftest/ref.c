@@ -222,6 +222,7 @@ static void csr_writeback() {
   dretpc->val    = cpu.dretpc;
   dretpcfz->val  = cpu.dretpcfz;
   dfreason->val = cpu.dfreason;
+  dasics_compile_table();
 #endif  // CONFIG_RV_DASICS
 
 #ifdef CONFIG_RV_DASICS
@@ -254,6 +255,8 @@ void isa_difftest_regcpy(void *dut, bool direction) {
 void isa_difftest_csrcpy(void *dut, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     memcpy(csr_array, dut, 4096 * sizeof(rtlreg_t));
+    IFDEF(CONFIG_RV_PMP_CHECK, pmp_compile_table());
+    IFDEF(CONFIG_RV_DASICS, dasics_compile_table());
   } else {
     memcpy(dut, csr_array, 4096 * sizeof(rtlreg_t));
   }
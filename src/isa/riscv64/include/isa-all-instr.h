@@ -170,6 +170,15 @@
 #define DASICS_INSTR_TERNARY(f)
 #endif  // CONFIG_RV_DASICS
 
+#ifdef CONFIG_TCACHE_FUSE
+#define FUSE_INSTR_TERNARY(f) \
+  f(p_lui_addi) f(p_call) f(p_tail) \
+  f(p_slt_beqz) f(p_slt_bnez) f(p_sltu_beqz) f(p_sltu_bnez) \
+  f(p_slti_beqz) f(p_slti_bnez) f(p_sltui_beqz) f(p_sltui_bnez)
+#else
+#define FUSE_INSTR_TERNARY(f)
+#endif  // CONFIG_TCACHE_FUSE
+
 #define INSTR_NULLARY(f) \
   f(inv) f(rt_inv) f(nemu_trap) \
   f(fence_i) f(fence) \
@@ -212,7 +221,8 @@
   BITMANIP_INSTR_TERNARY(f) \
   CRYPTO_INSTR_TERNARY(f) \
   VECTOR_INSTR_TERNARY(f) \
-  DASICS_INSTR_TERNARY(f)
+  DASICS_INSTR_TERNARY(f) \
+  FUSE_INSTR_TERNARY(f)
 
 def_all_EXEC_ID();
 
@@ -126,6 +126,9 @@ typedef struct {
   // for LR/SC
   uint64_t lr_addr;
   uint64_t lr_valid;
+#ifdef CONFIG_MULTIHART
+  uint64_t lr_val; // sc fails if another hart has changed it
+#endif
 
   bool INTR;
 
@@ -282,6 +285,9 @@ enum { MODE_U = 0, MODE_S, MODE_H, MODE_M };
 int get_data_mmu_state();
 #define isa_mmu_state() get_data_mmu_state()
 
+// direct jumps keep their targets in src1, and branches in dest
+#define isa_jnpc(s) ((s)->type == INSTR_TYPE_B ? (s)->dest.imm : (s)->src1.imm)
+
 
 
 #endif
@@ -32,9 +32,13 @@ void init_csr();
 void init_clint();
 #endif
 void init_device();
+#ifdef CONFIG_MULTIHART
+void init_csr_ptr();
+#endif
 
-void init_isa() {
-  init_csr();
+// reset the state of the hart running on the calling thread
+static void reset_hart() {
+  IFDEF(CONFIG_MULTIHART, init_csr_ptr());
 
 #ifndef CONFIG_RESET_FROM_MMIO
   cpu.pc = RESET_VECTOR;
@@ -54,6 +58,7 @@ void init_isa() {
 #ifdef CONFIG_RV_PMP_CSR
   pmpcfg0->val = 0;
   pmpcfg2->val = 0;
+  IFDEF(CONFIG_RV_PMP_CHECK, pmp_compile_table());
 #endif // CONFIG_RV_PMP_CSR
 
 #ifdef CONFIG_RV_SVINVAL
@@ -64,6 +69,7 @@ void init_isa() {
   upkru->val = 0;
   spkrs->val = 0;
   spkctl->val = 0;
+  dasics_compile_table();
 #endif  // CONFIG_RV_DASICS
 
 #ifdef CONFIG_RVN
@@ -100,6 +106,11 @@ void init_isa() {
     mimpid->val = CONFIG_MIMPID_VALUE;
   #endif // CONFIG_USE_XS_ARCH_CSRS
 #endif // CONFIG_RV_ARCH_CSRS
+}
+
+void init_isa() {
+  init_csr();
+  reset_hart();
 
 #ifndef CONFIG_SHARE
   extern char *cpt_file;
@@ -115,3 +126,10 @@ void init_isa() {
   Log("NEMU will start from pc 0x%lx", cpu.pc);
 #endif
 }
+
+#ifdef CONFIG_MULTIHART
+void isa_init_hart(int id) {
+  reset_hart();
+  mhartid->val = id;
+}
+#endif
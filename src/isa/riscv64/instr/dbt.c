@@ -0,0 +1,171 @@
+/***************************************************************************************
+* Copyright (c) 2014-2021 Zihao Yu, Nanjing University
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/cpu.h>
+#include <cpu/exec.h>
+#include <cpu/difftest.h>
+#include <cpu/decode.h>
+#include <isa-all-instr.h>
+
+#ifdef CONFIG_ENGINE_DBT
+#include <cpu/dbt.h>
+
+// The instructions without host code of their own call their EHelpers
+// compiled as functions. Only data instructions are called this way, so
+// the macros for control flow in cpu-exec.c are not needed.
+#undef def_EHelper
+#define def_EHelper(name) static void concat(dbt_exec_, name) (Decode *s)
+#define rtl_priv_next(s)
+#define ras_push_j(s) do { } while (0)
+#define ras_push_jr(s) do { } while (0)
+#define ras_ret(s, target) do { } while (0)
+// fused pairs only run their first instruction, see below
+#define fuse_next(s, name) do { } while (0)
+#define fuse_skip(s) do { } while (0)
+
+#include "isa-exec.h"
+
+#define FILL_DBT_EXEC_TABLE(name) [concat(EXEC_ID_, name)] = concat(dbt_exec_, name),
+static void (*dbt_exec_table[TOTAL_INSTR])(Decode *) = {
+  MAP(INSTR_LIST, FILL_DBT_EXEC_TABLE)
+};
+
+#define DBT_LDST(suffix, mmu_mode) \
+  case concat(EXEC_ID_ld , suffix): dbt_lm(s, ddest, dsrc1, id_src2->imm, 8, mmu_mode, true); break; \
+  case concat(EXEC_ID_lw , suffix): dbt_lm(s, ddest, dsrc1, id_src2->imm, 4, mmu_mode, true); break; \
+  case concat(EXEC_ID_lh , suffix): dbt_lm(s, ddest, dsrc1, id_src2->imm, 2, mmu_mode, true); break; \
+  case concat(EXEC_ID_lb , suffix): dbt_lm(s, ddest, dsrc1, id_src2->imm, 1, mmu_mode, true); break; \
+  case concat(EXEC_ID_lwu, suffix): dbt_lm(s, ddest, dsrc1, id_src2->imm, 4, mmu_mode, false); break; \
+  case concat(EXEC_ID_lhu, suffix): dbt_lm(s, ddest, dsrc1, id_src2->imm, 2, mmu_mode, false); break; \
+  case concat(EXEC_ID_lbu, suffix): dbt_lm(s, ddest, dsrc1, id_src2->imm, 1, mmu_mode, false); break; \
+  case concat(EXEC_ID_sd , suffix): dbt_sm(s, ddest, dsrc1, id_src2->imm, 8, mmu_mode); break; \
+  case concat(EXEC_ID_sw , suffix): dbt_sm(s, ddest, dsrc1, id_src2->imm, 4, mmu_mode); break; \
+  case concat(EXEC_ID_sh , suffix): dbt_sm(s, ddest, dsrc1, id_src2->imm, 2, mmu_mode); break; \
+  case concat(EXEC_ID_sb , suffix): dbt_sm(s, ddest, dsrc1, id_src2->imm, 1, mmu_mode); break;
+
+bool isa_dbt_translate(Decode *s, int idx) {
+  switch (idx) {
+    // rvi/compute.h
+    case EXEC_ID_add:   dbt_alu(DBT_ADD, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_sub:   dbt_alu(DBT_SUB, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_sll:   dbt_alu(DBT_SHL, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_sra:   dbt_alu(DBT_SAR, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_srl:   dbt_alu(DBT_SHR, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_xor:   dbt_alu(DBT_XOR, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_or:    dbt_alu(DBT_OR,  ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_and:   dbt_alu(DBT_AND, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_slt:   dbt_setrelop(RELOP_LT,  ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_sltu:  dbt_setrelop(RELOP_LTU, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_addi:  dbt_alui(DBT_ADD, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_slli:  dbt_alui(DBT_SHL, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_srai:  dbt_alui(DBT_SAR, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_srli:  dbt_alui(DBT_SHR, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_xori:  dbt_alui(DBT_XOR, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_ori:   dbt_alui(DBT_OR,  ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_andi:  dbt_alui(DBT_AND, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_slti:  dbt_setrelopi(RELOP_LT,  ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_sltui: dbt_setrelopi(RELOP_LTU, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_auipc:
+    case EXEC_ID_lui:   dbt_li(ddest, id_src1->imm); break;
+    case EXEC_ID_addw:  dbt_alu(DBT_ADDW, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_subw:  dbt_alu(DBT_SUBW, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_sllw:  dbt_alu(DBT_SHLW, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_srlw:  dbt_alu(DBT_SHRW, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_sraw:  dbt_alu(DBT_SARW, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_addiw: dbt_alui(DBT_ADDW, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_slliw: dbt_alui(DBT_SHLW, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_srliw: dbt_alui(DBT_SHRW, ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_sraiw: dbt_alui(DBT_SARW, ddest, dsrc1, id_src2->imm); break;
+
+    // rvm/exec.h
+    case EXEC_ID_mul:   dbt_alu(DBT_MUL,  ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_mulw:  dbt_alu(DBT_MULW, ddest, dsrc1, dsrc2); break;
+
+    // rvc/exec.h
+    case EXEC_ID_c_li:    dbt_li(ddest, id_src2->imm); break;
+    case EXEC_ID_c_addi:  dbt_alui(DBT_ADD,  ddest, ddest, id_src2->imm); break;
+    case EXEC_ID_c_addiw: dbt_alui(DBT_ADDW, ddest, ddest, id_src2->imm); break;
+    case EXEC_ID_c_slli:  dbt_alui(DBT_SHL,  ddest, ddest, id_src2->imm); break;
+    case EXEC_ID_c_srli:  dbt_alui(DBT_SHR,  ddest, ddest, id_src2->imm); break;
+    case EXEC_ID_c_srai:  dbt_alui(DBT_SAR,  ddest, ddest, id_src2->imm); break;
+    case EXEC_ID_c_andi:  dbt_alui(DBT_AND,  ddest, ddest, id_src2->imm); break;
+    case EXEC_ID_c_mv:    dbt_alui(DBT_ADD,  ddest, dsrc1, 0); break;
+    case EXEC_ID_c_add:   dbt_alu(DBT_ADD,  ddest, ddest, dsrc2); break;
+    case EXEC_ID_c_and:   dbt_alu(DBT_AND,  ddest, ddest, dsrc2); break;
+    case EXEC_ID_c_or:    dbt_alu(DBT_OR,   ddest, ddest, dsrc2); break;
+    case EXEC_ID_c_xor:   dbt_alu(DBT_XOR,  ddest, ddest, dsrc2); break;
+    case EXEC_ID_c_sub:   dbt_alu(DBT_SUB,  ddest, ddest, dsrc2); break;
+    case EXEC_ID_c_addw:  dbt_alu(DBT_ADDW, ddest, ddest, dsrc2); break;
+    case EXEC_ID_c_subw:  dbt_alu(DBT_SUBW, ddest, ddest, dsrc2); break;
+
+    // pseudo.h
+    case EXEC_ID_p_sext_w: dbt_alui(DBT_ADDW, ddest, dsrc1, 0); break;
+    case EXEC_ID_p_li_0:   dbt_li(ddest, 0); break;
+    case EXEC_ID_p_li_1:   dbt_li(ddest, 1); break;
+    case EXEC_ID_p_inc:    dbt_alui(DBT_ADD, ddest, ddest, 1); break;
+    case EXEC_ID_p_dec:    dbt_alui(DBT_SUB, ddest, ddest, 1); break;
+#ifdef CONFIG_TCACHE_FUSE
+    // the second instruction is kept in the next entry, and translated on its own
+    case EXEC_ID_p_lui_addi:
+    case EXEC_ID_p_call:
+    case EXEC_ID_p_tail:      dbt_li(ddest, id_src1->imm); break;
+    case EXEC_ID_p_slt_beqz:
+    case EXEC_ID_p_slt_bnez:  dbt_setrelop(RELOP_LT,  ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_p_sltu_beqz:
+    case EXEC_ID_p_sltu_bnez: dbt_setrelop(RELOP_LTU, ddest, dsrc1, dsrc2); break;
+    case EXEC_ID_p_slti_beqz:
+    case EXEC_ID_p_slti_bnez: dbt_setrelopi(RELOP_LT,  ddest, dsrc1, id_src2->imm); break;
+    case EXEC_ID_p_sltui_beqz:
+    case EXEC_ID_p_sltui_bnez: dbt_setrelopi(RELOP_LTU, ddest, dsrc1, id_src2->imm); break;
+#endif
+
+    // rvi/ldst.h
+    DBT_LDST(, MMU_DIRECT)
+    DBT_LDST(_mmu, MMU_TRANSLATE)
+
+    // branches and direct jumps inlined in superblocks, which skip the DASICS
+    // control-flow checks done by rtl_j() and rtl_jrelop()
+#ifndef CONFIG_RV_DASICS
+    case EXEC_ID_beq:    dbt_jrelop(s, RELOP_EQ,  dsrc1, dsrc2); break;
+    case EXEC_ID_bne:    dbt_jrelop(s, RELOP_NE,  dsrc1, dsrc2); break;
+    case EXEC_ID_blt:    dbt_jrelop(s, RELOP_LT,  dsrc1, dsrc2); break;
+    case EXEC_ID_bge:    dbt_jrelop(s, RELOP_GE,  dsrc1, dsrc2); break;
+    case EXEC_ID_bltu:   dbt_jrelop(s, RELOP_LTU, dsrc1, dsrc2); break;
+    case EXEC_ID_bgeu:   dbt_jrelop(s, RELOP_GEU, dsrc1, dsrc2); break;
+    case EXEC_ID_c_beqz: dbt_jrelop(s, RELOP_EQ,  dsrc1, rz); break;
+    case EXEC_ID_c_bnez: dbt_jrelop(s, RELOP_NE,  dsrc1, rz); break;
+    case EXEC_ID_p_blez: dbt_jrelop(s, RELOP_GE,  rz, dsrc2); break;
+    case EXEC_ID_p_bgtz: dbt_jrelop(s, RELOP_LT,  rz, dsrc2); break;
+    case EXEC_ID_p_bltz: dbt_jrelop(s, RELOP_LT,  dsrc1, rz); break;
+    case EXEC_ID_p_bgez: dbt_jrelop(s, RELOP_GE,  dsrc1, rz); break;
+    case EXEC_ID_jal:    dbt_li(ddest, id_src2->imm); break;
+    case EXEC_ID_c_j:    break;
+#ifndef CONFIG_TCACHE_RAS
+    case EXEC_ID_p_jal:  dbt_li(&cpu.gpr[1]._64, id_src2->imm); break;
+#endif
+#endif
+
+    // they may flush the tcache or change the privilege mode, see rtl_priv_next()
+    case EXEC_ID_system:
+    case EXEC_ID_fence_i: return false;
+
+    default:
+      if (s->type != INSTR_TYPE_N) return false;
+      dbt_call(s, dbt_exec_table[idx]);
+  }
+  return true;
+}
+#endif
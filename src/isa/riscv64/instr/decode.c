@@ -85,47 +85,81 @@ def_THelper(main) {
   return table_inv(s);
 };
 
+#ifdef CONFIG_TCACHE_RAS
+// Calls push the return address stack, and only p_ret pops it. Other hints
+// from the unprivileged spec, such as returning through t0, are rare enough.
+static inline int ras_op(Decode *s, int idx) {
+  switch (idx) {
+    case EXEC_ID_p_jal: case EXEC_ID_c_jalr: return RAS_PUSH;
+    case EXEC_ID_p_ret: return RAS_POP;
+    case EXEC_ID_jalr:
+      if (s->isa.instr.r.opcode1_0 != 0x3) return RAS_PUSH; // c.jalr ra
+      return (s->isa.instr.i.rd == 1 || s->isa.instr.i.rd == 5) ? RAS_PUSH : RAS_NONE;
+  }
+  return RAS_NONE;
+}
+#endif
+
+// the next instruction fetched checks the transfer, see dasics_fetch_helper()
+#if defined(CONFIG_RV_DASICS) && !defined(CONFIG_PERF_OPT)
+#define dasics_set_cfi(s, t) do { s->prev_is_cfi = 1; s->prev_type = t; } while (0)
+#else
+#define dasics_set_cfi(s, t)
+#endif
+
 int isa_fetch_decode(Decode *s) {
   int idx = EXEC_ID_inv;
 
   //TODO: DASICS fetch check
-  // Logm("fetch instruction from:%lx, last pc is %lx", s->snpc,s->prev_pc);
+  // Logm("fetch instruction from:%lx, last pc is %lx", s->pc,s->prev_pc);
 #ifdef CONFIG_RV_DASICS
+  // with CONFIG_PERF_OPT, instructions are only decoded once, so control
+  // transfers are checked on their edges instead, see dasics_cfi_check()
+#ifndef CONFIG_PERF_OPT
   if(s->prev_is_cfi)
-    dasics_fetch_helper(s->snpc, s->prev_pc, s->prev_type);
+    dasics_fetch_helper(s->pc, s->prev_pc, s->prev_type);
+#endif
+  s->dasics_tag = 0;
 #endif
 
-  s->isa.instr.val = instr_fetch(&s->snpc, 2);
+  vaddr_t snpc = s->pc;
+  s->isa.instr.val = instr_fetch(&snpc, 2);
   if (s->isa.instr.r.opcode1_0 != 0x3) {
     // this is an RVC instruction
+    s->ilen = 2;
     idx = table_rvc(s);
   } else {
     // this is a 4-byte instruction, should fetch the MSB part
     // NOTE: The fetch here may cause IPF.
     // If it is the case, we should have mepc = xxxffe and mtval = yyy000.
     // Refer to `mtval` in the privileged manual for more details.
-    uint32_t hi = instr_fetch(&s->snpc, 2);
+    uint32_t hi = instr_fetch(&snpc, 2);
     s->isa.instr.val |= (hi << 16);
+    s->ilen = 4;
     idx = table_main(s);
   }
 
+#if defined(CONFIG_RV_DASICS) && !defined(CONFIG_PERF_OPT)
   s->prev_is_cfi = 0;
   s->prev_type   = CFI_NONE;
+#endif
   s->type = INSTR_TYPE_N;
   switch (idx) {
     case EXEC_ID_c_j: case EXEC_ID_p_jal: case EXEC_ID_jal:
     IFDEF(CONFIG_RV_DASICS, case EXEC_ID_dasicscall_j:)
-      s->prev_is_cfi = 1; s->prev_type  = CFI_JUMP; s->jnpc = id_src1->imm; s->type = INSTR_TYPE_J; break;
+      dasics_set_cfi(s, CFI_JUMP);
+      s->type = INSTR_TYPE_J; break;
 
     case EXEC_ID_beq: case EXEC_ID_bne: case EXEC_ID_blt: case EXEC_ID_bge:
     case EXEC_ID_bltu: case EXEC_ID_bgeu:
     case EXEC_ID_c_beqz: case EXEC_ID_c_bnez:
     case EXEC_ID_p_bltz: case EXEC_ID_p_bgez: case EXEC_ID_p_blez: case EXEC_ID_p_bgtz:
-      s->prev_is_cfi = 1; s->prev_type  = CFI_BRANCH; s->jnpc = id_dest->imm; s->type = INSTR_TYPE_B; break;
+      dasics_set_cfi(s, CFI_BRANCH);
+      s->type = INSTR_TYPE_B; break;
 
     case EXEC_ID_p_ret: case EXEC_ID_c_jr: case EXEC_ID_c_jalr: case EXEC_ID_jalr:
     IFDEF(CONFIG_RV_DASICS, case EXEC_ID_dasicscall_jr:)
-      s->prev_is_cfi = 1; s->prev_type  = CFI_JUMP;
+      dasics_set_cfi(s, CFI_JUMP);
     IFDEF(CONFIG_DEBUG, case EXEC_ID_mret: case EXEC_ID_sret: case EXEC_ID_ecall: \
       IFDEF(CONFIG_RVN, case EXEC_ID_uret:))
       s->type = INSTR_TYPE_I; break;
@@ -147,5 +181,73 @@ int isa_fetch_decode(Decode *s) {
 #endif
   }
 
+  IFDEF(CONFIG_TCACHE_RAS, s->ras_op = ras_op(s, idx));
   return idx;
 }
+
+#ifdef CONFIG_TCACHE_FUSE
+#define FUSE_SETRELOP(name) \
+  case concat(EXEC_ID_, name): \
+    *prev_idx = (*idx == EXEC_ID_c_beqz ? concat3(EXEC_ID_p_, name, _beqz) : concat3(EXEC_ID_p_, name, _bnez)); \
+    return true;
+
+// Fuse `s` with `prev`, the instruction before it in the same basic block.
+// Only `prev` may start executing the pair, so `s` can be rewritten with
+// what is known from `prev`, while still being valid on its own.
+bool isa_fuse(Decode *prev, int *prev_idx, Decode *s, int *idx) {
+  switch (*prev_idx) {
+    case EXEC_ID_lui: {
+      if (s->dest.preg != prev->dest.preg) return false;
+      sword_t imm = prev->src1.simm;
+      switch (*idx) {
+        case EXEC_ID_addi:
+          if (s->src1.preg != prev->dest.preg) return false;
+          imm += s->src2.simm; break;
+        case EXEC_ID_addiw:
+          if (s->src1.preg != prev->dest.preg) return false;
+          imm = (int32_t)(imm + s->src2.simm); break;
+        case EXEC_ID_c_addi:  imm += s->src2.simm; break;
+        case EXEC_ID_c_addiw: imm = (int32_t)(imm + s->src2.simm); break;
+        case EXEC_ID_p_inc:   imm += 1; break;
+        case EXEC_ID_p_dec:   imm -= 1; break;
+        default: return false;
+      }
+      prev->src2.simm = imm;
+      *prev_idx = EXEC_ID_p_lui_addi;
+      return true;
+    }
+
+    case EXEC_ID_auipc: {
+      if (s->type != INSTR_TYPE_I || s->src1.preg != prev->dest.preg) return false;
+      vaddr_t target = prev->src1.imm;
+      int link; // the register linked, 0 for none
+      switch (*idx) {
+        case EXEC_ID_p_ret: case EXEC_ID_c_jr: link = 0; break;
+        case EXEC_ID_c_jalr: link = 1; break;
+        case EXEC_ID_jalr:
+          target += s->src2.imm;
+          link = (s->isa.instr.r.opcode1_0 != 0x3 ? 1 : s->isa.instr.i.rd);
+          break;
+        default: return false;
+      }
+      // now it is a direct jump
+      target &= ~(vaddr_t)1;
+      *idx = (link == 1 ? EXEC_ID_p_jal : link == 0 ? EXEC_ID_c_j : EXEC_ID_jal);
+      s->src1.imm = target;
+      s->src2.imm = decode_snpc(s);
+      s->type = INSTR_TYPE_J;
+      IFDEF(CONFIG_TCACHE_RAS, s->ras_op = ras_op(s, *idx));
+      if (link <= 1) *prev_idx = (link == 1 ? EXEC_ID_p_call : EXEC_ID_p_tail);
+      return true;
+    }
+
+    case EXEC_ID_slt: case EXEC_ID_sltu: case EXEC_ID_slti: case EXEC_ID_sltui:
+      if (*idx != EXEC_ID_c_beqz && *idx != EXEC_ID_c_bnez) return false;
+      if (s->src1.preg != prev->dest.preg) return false;
+      switch (*prev_idx) {
+        FUSE_SETRELOP(slt) FUSE_SETRELOP(sltu) FUSE_SETRELOP(slti) FUSE_SETRELOP(sltui)
+      }
+  }
+  return false;
+}
+#endif
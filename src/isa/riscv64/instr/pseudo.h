@@ -26,8 +26,8 @@
 //       l{b|h|w|d} symbol
 //       s{b|h|w|d} symbol
 //       bgt    ble    bgtu   bleu
-//       call   tail
 //       fence
+//     call and tail are fused in the trace cache with CONFIG_TCACHE_FUSE
 // (3) still not considered
 //       fmv.s  fabs.s fneg.s
 //       fmv.d  fabs.d fneg.d
@@ -61,6 +61,7 @@ def_EHelper(p_bgez) {
 def_EHelper(p_jal) {
   IFDEF(CONFIG_RV_DASICS, rtl_dasics_jcheck(s, id_src1->imm));
   rtl_li(s, &cpu.gpr[1]._64, id_src2->imm);
+  IFDEF(CONFIG_TCACHE_RAS, ras_push_j(s));
   rtl_j(s, id_src1->imm);
 }
 
@@ -74,6 +75,7 @@ def_EHelper(p_ret) {
 //  IFDEF(CONFIG_ENGINE_INTERPRETER, rtl_andi(s, s0, s0, ~0x1u));
   IFDEF(CONFIG_RV_DASICS, rtl_dasics_jcheck(s, (vaddr_t)(cpu.gpr[1]._64)));
   IFNDEF(CONFIG_DIFFTEST_REF_NEMU, difftest_skip_dut(1, 2));
+  IFDEF(CONFIG_TCACHE_RAS, ras_ret(s, &cpu.gpr[1]._64));
   rtl_jr(s, &cpu.gpr[1]._64);
 #endif // CONFIG_SHARE
 }
@@ -95,3 +97,67 @@ def_EHelper(p_inc) {
 def_EHelper(p_dec) {
   rtl_subi(s, ddest, ddest, 1);
 }
+
+#ifdef CONFIG_TCACHE_FUSE
+// Instruction pairs fused in the trace cache, see isa_fuse(). The second
+// instruction is kept in the next entry. It is either skipped, or reached
+// with a direct goto instead of another dispatch.
+
+// lui + addi to the same register, with the sum folded into src2
+def_EHelper(p_lui_addi) {
+  rtl_li(s, ddest, id_src2->imm);
+  fuse_skip(s);
+}
+
+// auipc + jalr, where the jalr is turned into p_jal or c_j
+def_EHelper(p_call) {
+  rtl_li(s, ddest, id_src1->imm);
+  fuse_next(s, p_jal);
+}
+
+def_EHelper(p_tail) {
+  rtl_li(s, ddest, id_src1->imm);
+  fuse_next(s, c_j);
+}
+
+// slt + beqz/bnez on the result
+def_EHelper(p_slt_beqz) {
+  rtl_setrelop(s, RELOP_LT, ddest, dsrc1, dsrc2);
+  fuse_next(s, c_beqz);
+}
+
+def_EHelper(p_slt_bnez) {
+  rtl_setrelop(s, RELOP_LT, ddest, dsrc1, dsrc2);
+  fuse_next(s, c_bnez);
+}
+
+def_EHelper(p_sltu_beqz) {
+  rtl_setrelop(s, RELOP_LTU, ddest, dsrc1, dsrc2);
+  fuse_next(s, c_beqz);
+}
+
+def_EHelper(p_sltu_bnez) {
+  rtl_setrelop(s, RELOP_LTU, ddest, dsrc1, dsrc2);
+  fuse_next(s, c_bnez);
+}
+
+def_EHelper(p_slti_beqz) {
+  rtl_setrelopi(s, RELOP_LT, ddest, dsrc1, id_src2->imm);
+  fuse_next(s, c_beqz);
+}
+
+def_EHelper(p_slti_bnez) {
+  rtl_setrelopi(s, RELOP_LT, ddest, dsrc1, id_src2->imm);
+  fuse_next(s, c_bnez);
+}
+
+def_EHelper(p_sltui_beqz) {
+  rtl_setrelopi(s, RELOP_LTU, ddest, dsrc1, id_src2->imm);
+  fuse_next(s, c_beqz);
+}
+
+def_EHelper(p_sltui_bnez) {
+  rtl_setrelopi(s, RELOP_LTU, ddest, dsrc1, id_src2->imm);
+  fuse_next(s, c_bnez);
+}
+#endif // CONFIG_TCACHE_FUSE
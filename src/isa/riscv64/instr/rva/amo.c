@@ -18,6 +18,47 @@
 #include <memory/paddr.h>
 #include <rtl/rtl.h>
 #include "../local-include/intr.h"
+#ifdef CONFIG_MULTIHART
+#include <memory/host-tlb.h>
+
+// Other harts may access the same memory, so the update is done with a
+// compare-and-swap on the host memory. On failure `old` gets the current
+// value, sign-extended as loaded by lr and amo*.w.
+static inline bool amo_cas(void *host, rtlreg_t *old, rtlreg_t val, int width) {
+  if (width == 8) {
+    return __atomic_compare_exchange_n((uint64_t *)host, (uint64_t *)old, val,
+        false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+  uint32_t expected = *old;
+  bool ok = __atomic_compare_exchange_n((uint32_t *)host, &expected, (uint32_t)val,
+      false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  *old = (int32_t)expected;
+  return ok;
+}
+#endif
+
+static inline rtlreg_t amo_op(uint32_t funct5, int width, rtlreg_t src1, rtlreg_t src2) {
+  switch (funct5) {
+    case 0b00001: return src2; // amoswap
+    case 0b00000: return src1 + src2;
+    case 0b01000: return src1 | src2;
+    case 0b01100: return src1 & src2;
+    case 0b00100: return src1 ^ src2;
+    case 0b10000: // amomin
+      if (width == 8) return ((int64_t)src1 < (int64_t)src2 ? src1 : src2);
+      else return ((int32_t)src1 < (int32_t)src2 ? src1 : src2);
+    case 0b10100: // amomax
+      if (width == 8) return ((int64_t)src1 > (int64_t)src2 ? src1 : src2);
+      else return ((int32_t)src1 > (int32_t)src2 ? src1 : src2);
+    case 0b11000: // amominu
+      if (width == 8) return ((uint64_t)src1 < (uint64_t)src2 ? src1 : src2);
+      else return ((uint32_t)src1 < (uint32_t)src2 ? src1 : src2);
+    case 0b11100: // amomaxu
+      if (width == 8) return ((uint64_t)src1 > (uint64_t)src2 ? src1 : src2);
+      else return ((uint32_t)src1 > (uint32_t)src2 ? src1 : src2);
+    default: assert(0);
+  }
+}
 
 __attribute__((cold))
 def_rtl(amo_slow_path, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2) {
@@ -29,6 +70,7 @@ def_rtl(amo_slow_path, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src
     rtl_lms(s, dest, src1, 0, width, MMU_DYNAMIC);
     cpu.lr_addr = *src1;
     cpu.lr_valid = 1;
+    IFDEF(CONFIG_MULTIHART, cpu.lr_val = *dest);
     return;
   } else if (funct5 == 0b00011) { // sc
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
@@ -40,7 +82,13 @@ def_rtl(amo_slow_path, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src
     // should check overlapping instead of equality
     int success = cpu.lr_addr == *src1 && cpu.lr_valid;
     if (success) {
+#ifdef CONFIG_MULTIHART
+      void *host = hosttlb_atomic_addr(s, *src1, width);
+      if (host != NULL) success = amo_cas(host, &cpu.lr_val, *src2, width);
+      else rtl_sm(s, src2, src1, 0, width, MMU_DYNAMIC);
+#else
       rtl_sm(s, src2, src1, 0, width, MMU_DYNAMIC);
+#endif
       cpu.lr_valid = 0;
     } else {
       // Even if scInvalid, SPF (if raised) also needs to be reported
@@ -65,30 +113,16 @@ def_rtl(amo_slow_path, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src
 
   cpu.amo = true;
   rtl_lms(s, s0, src1, 0, width, MMU_DYNAMIC);
-  switch (funct5) {
-    case 0b00001: rtl_mv (s, s1, src2); break;
-    case 0b00000: rtl_add(s, s1, s0, src2); break;
-    case 0b01000: rtl_or (s, s1, s0, src2); break;
-    case 0b01100: rtl_and(s, s1, s0, src2); break;
-    case 0b00100: rtl_xor(s, s1, s0, src2); break;
-    case 0b10000: // amomin
-      if (width == 8) *s1 = ((int64_t)*s0 < (int64_t)*src2 ? *s0 : *src2);
-      else *s1 = ((int32_t)*s0 < (int32_t)*src2 ? *s0 : *src2);
-      break;
-    case 0b10100: // amomax
-      if (width == 8) *s1 = ((int64_t)*s0 > (int64_t)*src2 ? *s0 : *src2);
-      else *s1 = ((int32_t)*s0 > (int32_t)*src2 ? *s0 : *src2);
-      break;
-    case 0b11000: // amominu
-      if (width == 8) *s1 = ((uint64_t)*s0 < (uint64_t)*src2 ? *s0 : *src2);
-      else *s1 = ((uint32_t)*s0 < (uint32_t)*src2 ? *s0 : *src2);
-      break;
-    case 0b11100: // amomaxu
-      if (width == 8) *s1 = ((uint64_t)*s0 > (uint64_t)*src2 ? *s0 : *src2);
-      else *s1 = ((uint32_t)*s0 > (uint32_t)*src2 ? *s0 : *src2);
-      break;
-    default: assert(0);
+#ifdef CONFIG_MULTIHART
+  void *host = hosttlb_atomic_addr(s, *src1, width);
+  if (host != NULL) {
+    while (!amo_cas(host, s0, amo_op(funct5, width, *s0, *src2), width));
+    rtl_mv(s, dest, s0);
+    cpu.amo = false;
+    return;
   }
+#endif
+  rtl_li(s, s1, amo_op(funct5, width, *s0, *src2));
   rtl_sm(s, s1, src1, 0, width, MMU_DYNAMIC);
   rtl_mv(s, dest, s0);
   cpu.amo = false;
@@ -55,13 +55,14 @@ def_EHelper(c_jalr) {
   // See rvi/control.h:26. JALR should set the LSB to 0.
   rtl_andi(s, s0, dsrc1, ~1UL);
   IFDEF(CONFIG_RV_DASICS, rtl_dasics_jcheck(s, *(vaddr_t *)s0));
-  rtl_li(s, &cpu.gpr[1]._64, s->snpc);
+  rtl_li(s, &cpu.gpr[1]._64, decode_snpc(s));
   rtl_jr(s, s0);
 #else
   IFDEF(CONFIG_RV_DASICS, rtl_dasics_jcheck(s, *(vaddr_t *)dsrc1));
-  rtl_li(s, &cpu.gpr[1]._64, s->snpc);
+  rtl_li(s, &cpu.gpr[1]._64, decode_snpc(s));
 //  IFDEF(CONFIG_ENGINE_INTERPRETER, rtl_andi(s, s0, s0, ~0x1lu));
   IFNDEF(CONFIG_DIFFTEST_REF_NEMU, difftest_skip_dut(1, 2));
+  IFDEF(CONFIG_TCACHE_RAS, ras_push_jr(s));
   rtl_jr(s, dsrc1);
 #endif
 }
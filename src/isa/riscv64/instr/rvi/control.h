@@ -32,12 +32,13 @@ def_EHelper(jalr) {
   if(cpu.guided_exec && cpu.execution_guide.force_set_jump_target) {
     rtl_li(s, ddest, cpu.execution_guide.jump_target);
   } else {
-    rtl_li(s, ddest, s->snpc);
+    rtl_li(s, ddest, decode_snpc(s));
   }
 #else
-  rtl_li(s, ddest, s->snpc);
+  rtl_li(s, ddest, decode_snpc(s));
 #endif
   IFNDEF(CONFIG_DIFFTEST_REF_NEMU, difftest_skip_dut(1, 3));
+  IFDEF(CONFIG_TCACHE_RAS, if (s->ras_op == RAS_PUSH) ras_push_jr(s););
   rtl_jr(s, s0);
 }
 
@@ -60,12 +61,12 @@ def_EHelper(dasicscall_jr) {
     rtl_set_dretpc(s, cpu.execution_guide.jump_target);
     rtl_li(s, ddest, cpu.execution_guide.jump_target);
   } else {
-    rtl_set_dretpc(s, s->snpc);
-    rtl_li(s, ddest, s->snpc);
+    rtl_set_dretpc(s, decode_snpc(s));
+    rtl_li(s, ddest, decode_snpc(s));
   }
 #else
-  rtl_set_dretpc(s, s->snpc);
-  rtl_li(s, ddest, s->snpc);
+  rtl_set_dretpc(s, decode_snpc(s));
+  rtl_li(s, ddest, decode_snpc(s));
 #endif
   IFNDEF(CONFIG_DIFFTEST_REF_NEMU, difftest_skip_dut(1, 3));
   rtl_jr(s, s0);
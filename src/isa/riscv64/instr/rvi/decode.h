@@ -24,7 +24,7 @@ static inline def_DopHelper(i) {
 
 static inline def_DopHelper(r) {
   bool load_val = flag;
-  static word_t zero_null = 0;
+  static HART_LOCAL word_t zero_null = 0;
   op->preg = (!load_val && val == 0) ? &zero_null : &reg_l(val);
   print_Dop(op->str, OP_STR_SIZE, "%s", reg_name(val, 4));
 #ifdef CONFIG_RVV
@@ -59,7 +59,7 @@ static inline def_DHelper(J) {
     (s->isa.instr.j.imm11 << 11) | (s->isa.instr.j.imm10_1 << 1);
   decode_op_i(s, id_src1, s->pc + offset, true);
   decode_op_r(s, id_dest, s->isa.instr.j.rd, false);
-  id_src2->imm = s->snpc;
+  id_src2->imm = decode_snpc(s);
 }
 
 static inline def_DHelper(B) {
@@ -311,7 +311,7 @@ static inline def_DHelper(dasicscall_j) {
     (s->isa.instr.dij.imm10_1 << 1);
   decode_op_i(s, id_src1, s->pc + offset, true);
   decode_op_r(s, id_dest, 1, false);  // link to ra
-  id_src2->imm = s->snpc;
+  id_src2->imm = decode_snpc(s);
 }
 #endif  // CONFIG_RV_DASICS
 
@@ -21,4 +21,6 @@ def_EHelper(fence_i) {
 
 def_EHelper(fence) {
   IFNDEF(CONFIG_DIFFTEST_REF_NEMU, difftest_skip_dut(1, 2));
+  // the host may still reorder a store with a later load of another hart
+  IFDEF(CONFIG_MULTIHART, __atomic_thread_fence(__ATOMIC_SEQ_CST));
 }
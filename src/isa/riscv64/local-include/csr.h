@@ -763,7 +763,8 @@ CSR_STRUCT_END(djcfg)
 
 #endif  // CONFIG_RV_DASICS
 
-#define CSRS_DECL(name, addr) extern concat(name, _t)* const name;
+// With several harts, each of them points these to its own csr_array in init_csr_ptr().
+#define CSRS_DECL(name, addr) extern HART_LOCAL concat(name, _t)* MUXNDEF(CONFIG_MULTIHART, const, ) name;
 MAP(CSRS, CSRS_DECL)
 #ifdef CONFIG_RVN
   MAP(NCSRS, CSRS_DECL)
@@ -799,9 +800,11 @@ uint8_t pmpcfg_from_index(int idx);
 word_t pmpaddr_from_index(int idx);
 word_t pmpaddr_from_csrid(int id);
 word_t pmp_tor_mask();
+void pmp_compile_table();
 
 // DASICS
 #ifdef CONFIG_RV_DASICS
+struct Decode;
 bool dasics_in_trusted_zone(uint64_t pc);
 uint8_t dasics_libcfg_from_index(int i);
 word_t dasics_libbound_from_index(int i);
@@ -809,9 +812,18 @@ uint16_t dasics_jumpcfg_from_index(int i);
 word_t dasics_jumpbound_low_from_index(int i);
 word_t dasics_jumpbound_high_from_index(int i);
 bool dasics_match_dlib(uint64_t addr, uint8_t cfg);
-void dasics_ldst_helper(vaddr_t pc, vaddr_t vaddr, int len, int type);
+void dasics_compile_table();
+void dasics_ldst_helper(struct Decode *s, vaddr_t vaddr, int len, int type);
 void dasics_fetch_helper(vaddr_t pc, vaddr_t prev_pc, uint8_t cfi_type);
 void dasics_check_trusted(vaddr_t pc);
+#ifdef CONFIG_PERF_OPT
+// Allowed control transfers are cached on their edge in the trace cache,
+// in s->dasics_tag tagged with ((dasics_epoch << 2) | cpu.mode) in bits 31:4,
+// see dasics_cfi_check().
+extern HART_LOCAL uint32_t dasics_epoch;
+#define DASICS_EDGE_ALLOWED(edge) (4u << (edge))
+void dasics_cfi_check(struct Decode *s, vaddr_t target, uint8_t cfi_type, int edge, bool indirect);
+#endif
 #endif  // CONFIG_RV_DASICS
 
 #endif
\ No newline at end of file
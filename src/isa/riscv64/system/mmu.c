@@ -17,6 +17,7 @@
 #include <isa.h>
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
+#include <memory/host-tlb.h>
 #include <cpu/cpu.h>
 #include "../local-include/csr.h"
 #include "../local-include/intr.h"
@@ -148,16 +149,94 @@ static inline bool check_permission(PTE *pte, bool ok, vaddr_t vaddr, int type)
   return true;
 }
 
+#ifdef CONFIG_RV_PTW_CACHE
+// Page walk cache. `ptw_cache[level]` holds the base of the level-`level`
+// page table reached through non-leaf PTEs, tagged with the root page table
+// and VPN[2:level+1]. Since the tag has the root, satp writes need no flush.
+#define PTW_CACHE_SIZE CONFIG_RV_PTW_CACHE_SIZE
+
+typedef struct {
+  word_t root;
+  word_t vpn;
+  word_t pg_base;
+  bool valid;
+} PTWCacheEntry;
+
+static HART_LOCAL PTWCacheEntry ptw_cache[PTW_LEVEL - 1][PTW_CACHE_SIZE];
+#ifdef CONFIG_RV_PTW_CACHE_STAT
+// shared by all harts
+static uint64_t ptw_cache_hit[PTW_LEVEL - 1], ptw_cache_miss;
+#define ptw_cache_stat(cnt) __atomic_fetch_add(&(cnt), 1, __ATOMIC_RELAXED)
+#endif
+
+static inline word_t ptw_cache_vpn(vaddr_t vaddr, int level) {
+  return (vaddr >> VPNiSHFT(level + 1)) & ((1ull << (9 * (PTW_LEVEL - 1 - level))) - 1);
+}
+
+static inline PTWCacheEntry* ptw_cache_slot(word_t root, word_t vpn, int level) {
+  return &ptw_cache[level][(vpn ^ root) % PTW_CACHE_SIZE];
+}
+
+// Return the level to start walking from, and the base of its page table in `pg_base`.
+static inline int ptw_cache_lookup(vaddr_t vaddr, word_t *pg_base) {
+  word_t root = satp->ppn;
+  for (int level = 0; level < PTW_LEVEL - 1; level ++) {
+    word_t vpn = ptw_cache_vpn(vaddr, level);
+    PTWCacheEntry *e = ptw_cache_slot(root, vpn, level);
+    if (e->valid && e->root == root && e->vpn == vpn) {
+      IFDEF(CONFIG_RV_PTW_CACHE_STAT, ptw_cache_stat(ptw_cache_hit[level]));
+      *pg_base = e->pg_base;
+      return level;
+    }
+  }
+  IFDEF(CONFIG_RV_PTW_CACHE_STAT, ptw_cache_stat(ptw_cache_miss));
+  *pg_base = PGBASE(satp->ppn);
+  return PTW_LEVEL - 1;
+}
+
+static inline void ptw_cache_fill(vaddr_t vaddr, int level, word_t pg_base) {
+  word_t root = satp->ppn;
+  word_t vpn = ptw_cache_vpn(vaddr, level);
+  *ptw_cache_slot(root, vpn, level) = (PTWCacheEntry) {
+    .root = root, .vpn = vpn, .pg_base = pg_base, .valid = true };
+}
+
+// Called by sfence.vma/sinval.vma and PMP writes. Only the leaf PTE of
+// `vaddr` has to be dropped by the spec, but also dropping the non-leaf
+// PTEs on its walk is cheap and tolerates sloppy guests.
+void ptw_cache_flush(vaddr_t vaddr) {
+  if (vaddr == 0) {
+    memset(ptw_cache, 0, sizeof(ptw_cache));
+    return;
+  }
+  for (int level = 0; level < PTW_LEVEL - 1; level ++) {
+    word_t vpn = ptw_cache_vpn(vaddr, level);
+    for (int i = 0; i < PTW_CACHE_SIZE; i ++) {
+      if (ptw_cache[level][i].vpn == vpn) ptw_cache[level][i].valid = false;
+    }
+  }
+}
+
+#ifdef CONFIG_RV_PTW_CACHE_STAT
+void ptw_cache_statistic() {
+  uint64_t total = ptw_cache_hit[0] + ptw_cache_hit[1] + ptw_cache_miss;
+  Log("page walk cache: %'ld walks, level-0 table hit = %'ld, level-1 table hit = %'ld, miss = %'ld",
+      total, ptw_cache_hit[0], ptw_cache_hit[1], ptw_cache_miss);
+}
+#endif
+#endif
+
 static paddr_t ptw(vaddr_t vaddr, int type) {
   Logtr("Page walking for 0x%lx\n", vaddr);
   word_t pg_base = PGBASE(satp->ppn);
   word_t p_pte; // pte pointer
   PTE pte;
-  int level;
+  int level = PTW_LEVEL - 1;
   int64_t vaddr39 = vaddr << (64 - 39);
   vaddr39 >>= (64 - 39);
   if ((uint64_t)vaddr39 != vaddr) goto bad;
-  for (level = PTW_LEVEL - 1; level >= 0;) {
+  IFDEF(CONFIG_RV_PTW_CACHE, level = ptw_cache_lookup(vaddr, &pg_base));
+  for (; level >= 0;) {
     p_pte = pg_base + VPNi(vaddr, level) * PTE_SIZE;
 #ifdef CONFIG_MULTICORE_DIFF
     pte.val = golden_pmem_read(p_pte, PTE_SIZE, 0, 0, 0);
@@ -178,6 +257,7 @@ static paddr_t ptw(vaddr_t vaddr, int type) {
     else {
       level --;
       if (level < 0) { goto bad; }
+      IFDEF(CONFIG_RV_PTW_CACHE, ptw_cache_fill(vaddr, level, pg_base));
     }
   }
 
@@ -211,8 +291,8 @@ bad:
   return MEM_RET_FAIL;
 }
 
-static int ifetch_mmu_state = MMU_DIRECT;
-static int data_mmu_state = MMU_DIRECT;
+static HART_LOCAL int ifetch_mmu_state = MMU_DIRECT;
+static HART_LOCAL int data_mmu_state = MMU_DIRECT;
 
 int get_data_mmu_state() {
   return (data_mmu_state == MMU_DIRECT ? MMU_DIRECT : MMU_TRANSLATE);
@@ -231,6 +311,11 @@ int update_mmu_state() {
   ifetch_mmu_state = update_mmu_state_internal(true);
   int data_mmu_state_old = data_mmu_state;
   data_mmu_state = update_mmu_state_internal(false);
+  // the permissions of data pages cached in host TLB depend on the effective mode, SUM and MXR,
+  // while instruction fetch only depends on the current mode
+  uint32_t data_mode = (mstatus->mprv ? mstatus->mpp : cpu.mode);
+  hosttlb_set_context(satp->asid, satp->val,
+      data_mode | (mstatus->sum << 2) | (mstatus->mxr << 3), cpu.mode | (1 << 4));
   return (data_mmu_state ^ data_mmu_state_old) ? true : false;
 }
 
@@ -360,6 +445,101 @@ int force_raise_pf(vaddr_t vaddr, int type){
   return MEM_RET_OK;
 }
 
+#ifdef CONFIG_RV_PMP_CHECK
+// PMP entries compiled into sorted, non-overlapping segments covering the
+// whole physical address space. Each segment records the highest-priority
+// entry matching it (-1 if none), so an access inside a single segment is
+// decided by a binary search instead of scanning all entries.
+typedef struct {
+  word_t start;
+  word_t end; // inclusive
+  int idx;
+  uint8_t cfg;
+} PMPSegment;
+
+static HART_LOCAL PMPSegment pmp_seg[2 * MAX_NUM_PMP + 1] = { { .start = 0, .end = -1, .idx = -1 } };
+static HART_LOCAL int pmp_nr_seg = 1;
+
+static inline bool pmp_cfg_allow(uint8_t cfg, int type, int mode) {
+  return
+    (mode == MODE_M && !(cfg & PMP_L)) ||
+    ((type == MEM_TYPE_READ || type == MEM_TYPE_IFETCH_READ ||
+      type == MEM_TYPE_WRITE_READ) && (cfg & PMP_R)) ||
+    (type == MEM_TYPE_WRITE && (cfg & PMP_W)) ||
+    (type == MEM_TYPE_IFETCH && (cfg & PMP_X));
+}
+
+// Must be called whenever pmpcfg or pmpaddr CSRs change.
+void pmp_compile_table() {
+  word_t lo[MAX_NUM_PMP], hi[MAX_NUM_PMP];
+  bool valid[MAX_NUM_PMP] = {};
+  word_t boundary[2 * MAX_NUM_PMP + 1];
+  int nr_boundary = 0;
+  boundary[nr_boundary ++] = 0;
+
+  // the same address matching as isa_pmp_check_permission()
+  word_t base = 0;
+  for (int i = 0; i < CONFIG_RV_PMP_NUM; i++) {
+    word_t pmpaddr = pmpaddr_from_index(i);
+    word_t tor = (pmpaddr & pmp_tor_mask()) << PMP_SHIFT;
+    uint8_t cfg = pmpcfg_from_index(i);
+
+    if (cfg & PMP_A) {
+      if ((cfg & PMP_A) == PMP_TOR) {
+        valid[i] = base < tor;
+        lo[i] = base;
+        hi[i] = tor - 1;
+      } else {
+        bool is_na4 = (cfg & PMP_A) == PMP_NA4;
+        word_t mask = (pmpaddr << 1) | (!is_na4) | ~pmp_tor_mask();
+        mask = ~(mask & ~(mask + 1)) << PMP_SHIFT;
+        valid[i] = true;
+        lo[i] = tor & mask;
+        hi[i] = lo[i] | ~mask;
+      }
+      if (valid[i]) {
+        boundary[nr_boundary ++] = lo[i];
+        if (hi[i] != (word_t)-1) boundary[nr_boundary ++] = hi[i] + 1;
+      }
+    }
+
+    base = tor;
+  }
+
+  for (int k = 1; k < nr_boundary; k ++) {
+    word_t b = boundary[k];
+    int j = k;
+    for (; j > 0 && boundary[j - 1] > b; j --) boundary[j] = boundary[j - 1];
+    boundary[j] = b;
+  }
+  pmp_nr_seg = 0;
+  for (int k = 0; k < nr_boundary; k ++) {
+    word_t start = boundary[k];
+    if (k > 0 && start == boundary[k - 1]) continue;
+    int idx = -1;
+    for (int i = 0; i < CONFIG_RV_PMP_NUM; i ++) {
+      if (valid[i] && lo[i] <= start && start <= hi[i]) { idx = i; break; }
+    }
+    if (pmp_nr_seg > 0 && pmp_seg[pmp_nr_seg - 1].idx == idx) continue;
+    pmp_seg[pmp_nr_seg ++] = (PMPSegment) {
+      .start = start, .idx = idx, .cfg = (idx < 0 ? 0 : pmpcfg_from_index(idx)) };
+  }
+  for (int k = 0; k < pmp_nr_seg; k ++) {
+    pmp_seg[k].end = (k == pmp_nr_seg - 1 ? (word_t)-1 : pmp_seg[k + 1].start - 1);
+  }
+}
+
+static inline const PMPSegment* pmp_table_lookup(paddr_t addr) {
+  int l = 0, r = pmp_nr_seg - 1;
+  while (l < r) {
+    int m = (l + r + 1) / 2;
+    if (pmp_seg[m].start <= addr) l = m;
+    else r = m - 1;
+  }
+  return &pmp_seg[l];
+}
+#endif
+
 bool isa_pmp_check_permission(paddr_t addr, int len, int type, int out_mode) {
   bool ifetch = (type == MEM_TYPE_IFETCH);
   __attribute__((unused)) uint32_t mode;
@@ -379,6 +559,13 @@ bool isa_pmp_check_permission(paddr_t addr, int len, int type, int out_mode) {
     return true;
   }
 
+  const PMPSegment *seg = pmp_table_lookup(addr);
+  paddr_t last = addr + len - 1;
+  if (likely(last >= addr && last <= seg->end)) {
+    return seg->idx < 0 ? mode == MODE_M : pmp_cfg_allow(seg->cfg, type, mode);
+  }
+
+  // the access spans several segments, scan the entries for the partial match rule
   word_t base = 0;
   for (int i = 0; i < CONFIG_RV_PMP_NUM; i++) {
     word_t pmpaddr = pmpaddr_from_index(i);
@@ -438,12 +625,7 @@ bool isa_pmp_check_permission(paddr_t addr, int len, int type, int out_mode) {
         // }
 #endif
 
-        return
-          (mode == MODE_M && !(cfg & PMP_L)) ||
-          ((type == MEM_TYPE_READ || type == MEM_TYPE_IFETCH_READ ||
-            type == MEM_TYPE_WRITE_READ) && (cfg & PMP_R)) ||
-          (type == MEM_TYPE_WRITE && (cfg & PMP_W)) ||
-          (type == MEM_TYPE_IFETCH && (cfg & PMP_X));
+        return pmp_cfg_allow(cfg, type, mode);
       }
     }
 
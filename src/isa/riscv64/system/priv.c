@@ -20,18 +20,24 @@
 #include <cpu/cpu.h>
 #include <cpu/difftest.h>
 #include <memory/paddr.h>
+#include <memory/host-tlb.h>
 #include <isa.h>
 
 int update_mmu_state();
+void ptw_cache_flush(vaddr_t vaddr);
 uint64_t clint_uptime();
 void fp_set_dirty();
 void fp_update_rm_cache(uint32_t rm);
 void vp_set_dirty();
 
-rtlreg_t csr_array[4096] = {};
+HART_LOCAL rtlreg_t csr_array[4096] = {};
 
+#ifdef CONFIG_MULTIHART
+#define CSRS_DEF(name, addr) HART_LOCAL concat(name, _t)* name = NULL;
+#else
 #define CSRS_DEF(name, addr) \
   concat(name, _t)* const name = (concat(name, _t) *)&csr_array[addr];
+#endif
 
 MAP(CSRS, CSRS_DEF)
 #ifdef CONFIG_RVV
@@ -50,6 +56,22 @@ MAP(CSRS, CSRS_DEF)
   MAP(MPK_CSRS, CSRS_DEF)
 #endif // CONFIG_RV_DASICS
 
+#ifdef CONFIG_MULTIHART
+#define CSRS_PTR(name, addr) name = (concat(name, _t) *)&csr_array[addr];
+void init_csr_ptr() {
+  MAP(CSRS, CSRS_PTR)
+#ifdef CONFIG_RVV
+  MAP(VCSRS, CSRS_PTR)
+#endif // CONFIG_RVV
+#ifdef CONFIG_RVN
+  MAP(NCSRS, CSRS_PTR)
+#endif // CONFIG_RVN
+#ifdef CONFIG_RV_ARCH_CSRS
+  MAP(ARCH_CSRS, CSRS_PTR)
+#endif // CONFIG_RV_ARCH_CSRS
+}
+#endif
+
 #define CSRS_EXIST(name, addr) csr_exist[addr] = 1;
 static bool csr_exist[4096] = {};
 void init_csr() {
@@ -72,7 +94,7 @@ void init_csr() {
 
 };
 
-rtlreg_t csr_perf;
+HART_LOCAL rtlreg_t csr_perf;
 
 static inline bool csr_is_legal(uint32_t addr, bool need_write, vaddr_t pc) {
   assert(addr < 4096);
@@ -146,6 +168,9 @@ static inline word_t* csr_decode(uint32_t addr) {
 #define is_write_pmpaddr (dest >= &(csr_array[CSR_PMPADDR0]) && dest < (&(csr_array[CSR_PMPADDR0]) + MAX_NUM_PMP))
 #define is_write_dasics_mem_bound (dest >= &(csr_array[CSR_DLBOUND0]) && dest < (&(csr_array[CSR_DLBOUND0]) + MAX_DASICS_LIBBOUNDS*2))
 #define is_write_dasics_jump_bound (dest >= &(csr_array[CSR_DJBOUND0]) && dest < (&(csr_array[CSR_DJBOUND0]) + MAX_DASICS_JUMPBOUNDS*2))
+#define is_write_dasics_csr (is_write(dsmcfg) || is_write(dsmbound0) || is_write(dsmbound1) || \
+  is_write(dumcfg) || is_write(dumbound0) || is_write(dumbound1) || \
+  (dest >= &(csr_array[CSR_DLCFG0]) && dest <= &(csr_array[CSR_DJCFG])))
 #define mask_bitset(old, mask, new) (((old) & ~(mask)) | ((new) & (mask)))
 
 #ifdef CONFIG_RV_DASICS
@@ -207,6 +232,109 @@ bool dasics_match_dlib(uint64_t addr, uint8_t cfg)
   return within_range;
 }
 
+// dlbound pairs compiled into sorted, non-overlapping segments covering the
+// whole address space. Each segment records the R/W permissions of the valid
+// bounds containing it, so that an access is checked as a whole range with
+// a binary search, instead of scanning all bounds for each of its bytes.
+typedef struct {
+  word_t start;
+  word_t end; // inclusive
+  uint8_t perm; // LIBCFG_R and LIBCFG_W
+} DasicsSegment;
+
+static HART_LOCAL DasicsSegment dasics_seg[2 * MAX_DASICS_LIBBOUNDS + 1] = { { .start = 0, .end = -1, .perm = 0 } };
+static HART_LOCAL int dasics_nr_seg = 1;
+static HART_LOCAL int dasics_last_seg = 0; // the segment of the last access allowed
+// Bumped whenever a DASICS CSR changes, see dasics_zone_cached().
+HART_LOCAL uint32_t dasics_epoch = 1;
+
+// Must be called whenever DASICS CSRs change.
+void dasics_compile_table() {
+  word_t boundary[2 * MAX_DASICS_LIBBOUNDS + 1];
+  int nr_boundary = 0;
+  boundary[nr_boundary ++] = 0;
+
+  for (int i = 0; i < MAX_DASICS_LIBBOUNDS; i ++) {
+    uint8_t cfgval = dasics_libcfg_from_index(i);
+    word_t boundlo = dasics_libbound_from_index(i << 1);
+    word_t boundhi = dasics_libbound_from_index((i << 1) + 1);
+    if ((cfgval & LIBCFG_V) && (cfgval & (LIBCFG_R | LIBCFG_W)) && boundlo < boundhi) {
+      boundary[nr_boundary ++] = boundlo;
+      boundary[nr_boundary ++] = boundhi;
+    }
+  }
+
+  for (int k = 1; k < nr_boundary; k ++) {
+    word_t b = boundary[k];
+    int j = k;
+    for (; j > 0 && boundary[j - 1] > b; j --) boundary[j] = boundary[j - 1];
+    boundary[j] = b;
+  }
+  dasics_nr_seg = 0;
+  for (int k = 0; k < nr_boundary; k ++) {
+    word_t start = boundary[k];
+    if (k > 0 && start == boundary[k - 1]) continue;
+    uint8_t perm = 0;
+    for (int i = 0; i < MAX_DASICS_LIBBOUNDS; i ++) {
+      uint8_t cfgval = dasics_libcfg_from_index(i);
+      if ((cfgval & LIBCFG_V) && dasics_libbound_from_index(i << 1) <= start &&
+          start < dasics_libbound_from_index((i << 1) + 1)) {
+        perm |= cfgval & (LIBCFG_R | LIBCFG_W);
+      }
+    }
+    if (dasics_nr_seg > 0 && dasics_seg[dasics_nr_seg - 1].perm == perm) continue;
+    dasics_seg[dasics_nr_seg ++] = (DasicsSegment) { .start = start, .perm = perm };
+  }
+  for (int k = 0; k < dasics_nr_seg; k ++) {
+    dasics_seg[k].end = (k == dasics_nr_seg - 1 ? (word_t)-1 : dasics_seg[k + 1].start - 1);
+  }
+  dasics_last_seg = 0;
+  if (++ dasics_epoch == (1u << 26)) {
+    // tags left in the trace cache would match again
+    dasics_epoch = 1;
+    IFDEF(CONFIG_PERF_OPT, set_sys_state_flag(SYS_STATE_FLUSH_TCACHE));
+  }
+  IFDEF(CONFIG_PERF_OPT, hosttlb_dasics_flush());
+}
+
+static inline int dasics_table_lookup(vaddr_t addr) {
+  int l = 0, r = dasics_nr_seg - 1;
+  while (l < r) {
+    int m = (l + r + 1) / 2;
+    if (dasics_seg[m].start <= addr) l = m;
+    else r = m - 1;
+  }
+  return l;
+}
+
+// Whether all bytes in [addr, addr + len) are within dlbounds with `perm`.
+// Otherwise the first byte which is not is returned in `fault`.
+static inline bool dasics_match_dlib_range(vaddr_t addr, int len, uint8_t perm, vaddr_t *fault) {
+  vaddr_t last = addr + len - 1;
+  const DasicsSegment *seg = &dasics_seg[dasics_last_seg];
+  if (likely(seg->start <= addr && last <= seg->end && (seg->perm & perm))) {
+    return true;
+  }
+  for (int k = dasics_table_lookup(addr); ; k ++) {
+    seg = &dasics_seg[k];
+    if (!(seg->perm & perm)) {
+      *fault = (seg->start > addr ? seg->start : addr);
+      return false;
+    }
+    dasics_last_seg = k;
+    if (last <= seg->end) return true;
+  }
+}
+
+// Whether the whole page of `vaddr` is within dlbounds allowing `type`, so
+// that the host TLB entry mapping it can tell that accesses are allowed.
+bool dasics_match_dlib_page(vaddr_t vaddr, int type) {
+  vaddr_t page = vaddr & ~(vaddr_t)PAGE_MASK;
+  const DasicsSegment *seg = &dasics_seg[dasics_table_lookup(page)];
+  uint8_t perm = (type == MEM_TYPE_WRITE ? LIBCFG_W : LIBCFG_R);
+  return (seg->perm & perm) && page + PAGE_SIZE - 1 <= seg->end;
+}
+
 bool dasics_match_djumpbound(uint64_t addr, uint8_t cfg) {
   bool within_range = false;
   for (int i = 0; i < MAX_DASICS_JUMPBOUNDS; ++i) {
@@ -223,69 +351,131 @@ bool dasics_match_djumpbound(uint64_t addr, uint8_t cfg) {
   return within_range;
 }
 
-void dasics_ldst_helper(vaddr_t pc, vaddr_t vaddr, int len, int type) {
+#define DASICS_ZONE_TRUSTED 0x1
+#define DASICS_ZONE_FREE    0x2 // within a jump bound
+
+static inline uint32_t dasics_zone(vaddr_t pc) {
+  return (dasics_in_trusted_zone(pc) ? DASICS_ZONE_TRUSTED : 0) |
+    (dasics_match_djumpbound(pc, JUMPCFG_V) ? DASICS_ZONE_FREE : 0);
+}
+
+// The zone of the pc of `s` only changes with the privilege mode and DASICS
+// CSRs, so it is cached in `s`, tagged with both. The edge verdicts cached
+// next to it are dropped along with it, see dasics_cfi_check().
+static inline uint32_t dasics_zone_cached(Decode *s) {
+  uint32_t tag = (dasics_epoch << 2) | cpu.mode;
+  if (likely((s->dasics_tag >> 4) == tag)) {
+    return s->dasics_tag & 3;
+  }
+  uint32_t zone = dasics_zone(s->pc);
+  s->dasics_tag = (tag << 4) | zone;
+  return zone;
+}
+
+static inline bool dasics_in_trusted_zone_cached(Decode *s) {
+  return dasics_zone_cached(s) & DASICS_ZONE_TRUSTED;
+}
+
+// Whether a control transfer from `src` zone to `pc` in `dst` zone is allowed.
+// Only returns to main and to the library from the free zone look at dretpc,
+// dmaincall and dretpcfz, which are written by dasicscall without a CSR write.
+static inline bool dasics_cfi_allowed(uint32_t src, uint32_t dst, vaddr_t pc, uint8_t cfi_type, bool *by_ret) {
+  bool src_trusted = src & DASICS_ZONE_TRUSTED, src_freezone = src & DASICS_ZONE_FREE;
+  bool dst_trusted = dst & DASICS_ZONE_TRUSTED, dst_freezone = dst & DASICS_ZONE_FREE;
+  *by_ret = false;
+  if (src_trusted || dst_freezone) return cfi_type == CFI_BRANCH || cfi_type == CFI_JUMP;
+  if (cfi_type != CFI_JUMP) return false;
+
+  bool allow_lib_to_main = dst_trusted && (pc == dretpc->val || pc == dmaincall->val);
+  bool allow_freezone_to_lib = src_freezone && !dst_trusted && (pc == dretpcfz->val);
+  *by_ret = true;
+  return allow_lib_to_main || allow_freezone_to_lib;
+}
+
+static void dasics_cfi_raise(vaddr_t pc, uint32_t src, uint32_t dst) {
+  int ex = (cpu.mode == MODE_U) ? EX_DUCF : EX_DSCF;
+  INTR_TVAL_REG(ex) = pc;
+  dfreason->val = DFR_JF;
+  Logm("Dasics fetch exception occur: pc%lx  (st:%d,df:%d)\n", pc,
+      (src & DASICS_ZONE_TRUSTED) != 0, (dst & DASICS_ZONE_FREE) != 0);
+  longjmp_exception(ex);
+}
+
+void dasics_ldst_helper(Decode *s, vaddr_t vaddr, int len, int type) {
   // TODO: What about MEM_TYPE_IFETCH ???
-  if (dasics_in_trusted_zone(pc)) {
+  if (dasics_in_trusted_zone_cached(s)) {
     return;
   }
+#ifdef CONFIG_PERF_OPT
+  if (hosttlb_dasics_allowed(vaddr, len, type)) {
+    return;
+  }
+#endif
+  vaddr_t fault;
   if (type == MEM_TYPE_WRITE) {
     int ex = (cpu.mode == MODE_U) ? EX_DUCF : EX_DSCF;
     bool close_st_ex = (cpu.mode == MODE_U) ? dsmcfg->mcfg_cust : dsmcfg->mcfg_csst;
-    for (int i = 0; i < len; ++i) {
-      if (!close_st_ex && !dasics_match_dlib(vaddr + i, LIBCFG_V | LIBCFG_W)) {
-        INTR_TVAL_REG(ex) = vaddr + i;  // To avoid store inst that crosses libzone
-        dfreason->val = DFR_SF;
-        Logm("Dasics store exception occur %lx", vaddr);
-        //isa_reg_display();
-        longjmp_exception(ex);
-        break;
-      }
+    if (!close_st_ex && !dasics_match_dlib_range(vaddr, len, LIBCFG_W, &fault)) {
+      INTR_TVAL_REG(ex) = fault;  // To avoid store inst that crosses libzone
+      dfreason->val = DFR_SF;
+      Logm("Dasics store exception occur %lx", vaddr);
+      //isa_reg_display();
+      longjmp_exception(ex);
     }
   }
   else if (type == MEM_TYPE_READ) {
     int ex = (cpu.mode == MODE_U) ? EX_DUCF : EX_DSCF;
     bool close_ld_ex = (cpu.mode == MODE_U) ? dsmcfg->mcfg_cult : dsmcfg->mcfg_cslt;
-    for (int i = 0; i < len; i++) {
-      if (!close_ld_ex && !dasics_match_dlib(vaddr + i, LIBCFG_V | LIBCFG_R)) {
-        INTR_TVAL_REG(ex) = vaddr + i;  // To avoid load inst that crosses libzone
-        dfreason->val = DFR_LF;
-        Logm("Dasics load exception occur %lx", vaddr);
-        //isa_reg_display();
-        longjmp_exception(ex);
-        break;
-      }
+    if (!close_ld_ex && !dasics_match_dlib_range(vaddr, len, LIBCFG_R, &fault)) {
+      INTR_TVAL_REG(ex) = fault;  // To avoid load inst that crosses libzone
+      dfreason->val = DFR_LF;
+      Logm("Dasics load exception occur %lx", vaddr);
+      //isa_reg_display();
+      longjmp_exception(ex);
     }
   }
 }
 void dasics_fetch_helper(vaddr_t pc, vaddr_t prev_pc, uint8_t cfi_type) {
-  bool src_trusted = dasics_in_trusted_zone(prev_pc);
-  bool dst_trusted = dasics_in_trusted_zone(pc);
-  bool src_freezone = dasics_match_djumpbound(prev_pc, JUMPCFG_V);
-  bool dst_freezone = dasics_match_djumpbound(pc, JUMPCFG_V);
+  uint32_t src = dasics_zone(prev_pc);
+  uint32_t dst = dasics_zone(pc);
   bool close_fetch_ex = (cpu.mode == MODE_U) ? dsmcfg->mcfg_cuft : dsmcfg->mcfg_csft;
 
-  Logm("[Dasics Fetch] prev_pc: 0x%lx (T:%d F:%d), pc:0x%lx (T:%d F:%d)\n", prev_pc, src_trusted, src_freezone, pc, dst_trusted, dst_freezone);
+  Logm("[Dasics Fetch] prev_pc: 0x%lx (zone:%d), pc:0x%lx (zone:%d)\n", prev_pc, src, pc, dst);
   Logm("[Dasics Fetch] dretpc: 0x%lx dretmaincall: 0x%lx dretpcfz: 0x%lx\n", dretpc->val, dmaincall->val, dretpcfz->val);
 
-  bool allow_lib_to_main = !src_trusted && dst_trusted && \
-    (pc == dretpc->val || pc == dmaincall->val);
-  bool allow_freezone_to_lib = src_freezone && !dst_trusted && \
-    !dst_freezone && (pc == dretpcfz->val);
-
-  bool allow_br   = src_trusted  || dst_freezone;
-  bool allow_jump = src_trusted  || allow_lib_to_main || \
-                    dst_freezone || allow_freezone_to_lib;
+  bool by_ret;
+  if (!dasics_cfi_allowed(src, dst, pc, cfi_type, &by_ret) && !close_fetch_ex) {
+    dasics_cfi_raise(pc, src, dst);
+  }
+}
 
-  bool allow_cfi = (cfi_type == CFI_BRANCH && allow_br) || (cfi_type == CFI_JUMP && allow_jump);
+#ifdef CONFIG_PERF_OPT
+// The trace cache decodes an instruction only once, so a control transfer is
+// checked when it is taken from `s` to `target`, instead of when the target is
+// fetched. `edge` indexes the verdict cached in s->dasics_tag for the
+// tnext/ntnext link it follows. It is only set for the verdicts which stay
+// the same until the privilege mode or a DASICS CSR changes, and for indirect
+// jumps, only when all targets are allowed.
+void dasics_cfi_check(Decode *s, vaddr_t target, uint8_t cfi_type, int edge, bool indirect) {
+  // also retags s->dasics_tag, so the verdict set below is current
+  uint32_t src = dasics_zone_cached(s);
+  bool close_fetch_ex = (cpu.mode == MODE_U) ? dsmcfg->mcfg_cuft : dsmcfg->mcfg_csft;
+  if (close_fetch_ex || (src & DASICS_ZONE_TRUSTED)) {
+    s->dasics_tag |= DASICS_EDGE_ALLOWED(edge);
+    return;
+  }
 
-  if (!allow_cfi && !close_fetch_ex) {
-    int ex = (cpu.mode == MODE_U) ? EX_DUCF : EX_DSCF;
-    INTR_TVAL_REG(ex) = pc;
-    dfreason->val = DFR_JF;
-    Logm("Dasics fetch exception occur: pc%lx  (st:%d,df:%d)\n",pc,src_trusted,dst_freezone);
-    longjmp_exception(ex);
+  uint32_t dst = dasics_zone(target);
+  bool by_ret;
+  if (dasics_cfi_allowed(src, dst, target, cfi_type, &by_ret)) {
+    if (!by_ret && !indirect) s->dasics_tag |= DASICS_EDGE_ALLOWED(edge);
+    return;
   }
+  // the jump is the faulting instruction, see hart_exec()
+  save_globals(s);
+  dasics_cfi_raise(target, src, dst);
 }
+#endif
 
 // void dasics_redirect_helper(vaddr_t pc, vaddr_t newpc, vaddr_t nextpc) {
 //   // Check whether this redirect instruction is permitted
@@ -611,7 +801,9 @@ static inline void csr_write(word_t *dest, word_t src) {
     }
 #endif
 
+    IFDEF(CONFIG_RV_PMP_CHECK, pmp_compile_table());
     mmu_tlb_flush(0);
+    IFDEF(CONFIG_RV_PTW_CACHE, ptw_cache_flush(0));
   }
   else if (is_write_pmpcfg) {
     // Log("Writing pmp config");
@@ -636,7 +828,9 @@ static inline void csr_write(word_t *dest, word_t src) {
 
     *dest = cfg_data;
 
+    IFDEF(CONFIG_RV_PMP_CHECK, pmp_compile_table());
     mmu_tlb_flush(0);
+    IFDEF(CONFIG_RV_PTW_CACHE, ptw_cache_flush(0));
   }
 #endif
 #ifdef CONFIG_RV_DASICS
@@ -657,6 +851,10 @@ static inline void csr_write(word_t *dest, word_t src) {
       *dest = MASKED_SATP(src);
   } else { *dest = src; }
 
+#ifdef CONFIG_RV_DASICS
+  if (is_write_dasics_csr) { dasics_compile_table(); }
+#endif  // CONFIG_RV_DASICS
+
   bool need_update_mstatus_sd = false;
   if (is_write(fflags) || is_write(frm) || is_write(fcsr)) {
 #ifdef CONFIG_FPU_NONE
@@ -673,8 +871,9 @@ static inline void csr_write(word_t *dest, word_t src) {
     update_mstatus_sd();
   }
 
-  if (is_write(mstatus) || is_write(satp)) { update_mmu_state(); }
-  if (is_write(satp)) { mmu_tlb_flush(0); } // when satp is changed(asid | ppn), flush tlb.
+  if (is_write(mstatus) || is_write(sstatus) || is_write(satp)) { update_mmu_state(); }
+  // host TLB entries are tagged with satp, but tcache is indexed by virtual pc
+  if (is_write(satp)) { set_sys_state_flag(SYS_STATE_FLUSH_TCACHE); }
   if (is_write(mstatus) || is_write(sstatus) || is_write(satp) ||
       is_write(mie) || is_write(sie) || is_write(mip) || is_write(sip)) {
     set_sys_state_flag(SYS_STATE_UPDATE);
@@ -766,7 +965,11 @@ static word_t priv_instr(uint32_t op, const rtlreg_t *src) {
     break;
 #endif // CONFIG_MODE_USER
     case -1: // fence.i
+#ifdef CONFIG_TCACHE_SMC
+      if (pmem_code_has_dirty()) set_sys_state_flag(SYS_STATE_FLUSH_CODE);
+#else
       set_sys_state_flag(SYS_STATE_FLUSH_TCACHE);
+#endif
       break;
     default:
       switch (op >> 5) { // instr[31:25]
@@ -776,7 +979,9 @@ static word_t priv_instr(uint32_t op, const rtlreg_t *src) {
           // while executing in S-mode will raise an illegal instruction exception.
           if (cpu.mode == MODE_S && mstatus->tvm == 1)
             longjmp_exception(EX_II);
-          mmu_tlb_flush(*src);
+          if (op & 0x1f) mmu_tlb_flush_asid(*src, reg_l(op & 0x1f) & ((1 << SATP_ASID_LEN) - 1));
+          else mmu_tlb_flush(*src);
+          IFDEF(CONFIG_RV_PTW_CACHE, ptw_cache_flush(*src));
           break;
 #ifdef CONFIG_RV_SVINVAL
         case 0x0b: // sinval.vma
@@ -784,7 +989,9 @@ static word_t priv_instr(uint32_t op, const rtlreg_t *src) {
             !srnctl->svinval) { // srnctl contrl extension enable or not
             longjmp_exception(EX_II);
           }
-          mmu_tlb_flush(*src);
+          if (op & 0x1f) mmu_tlb_flush_asid(*src, reg_l(op & 0x1f) & ((1 << SATP_ASID_LEN) - 1));
+          else mmu_tlb_flush(*src);
+          IFDEF(CONFIG_RV_PTW_CACHE, ptw_cache_flush(*src));
           break;
 #endif // CONFIG_RV_SVINVAL
         default:
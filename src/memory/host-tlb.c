@@ -18,43 +18,326 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
+#include <device/mmio.h>
 #include <cpu/cpu.h>
 
-#define HOSTTLB_SIZE_SHIFT 12
+#define HOSTTLB_SIZE_SHIFT MUXDEF(CONFIG_PERF_OPT, CONFIG_HOSTTLB_SIZE_SHIFT, 12)
 #define HOSTTLB_SIZE (1 << HOSTTLB_SIZE_SHIFT)
+#define HOSTTLB_WAYS MUXDEF(CONFIG_PERF_OPT, CONFIG_HOSTTLB_WAYS, 1)
+#define HOSTTLB_SETS (HOSTTLB_SIZE / HOSTTLB_WAYS)
+#define HOSTTLB_VICTIM_SIZE MUXDEF(CONFIG_PERF_OPT, CONFIG_HOSTTLB_VICTIM_SIZE, 0)
+#define HOSTTLB_VICTIM_ALLOC (HOSTTLB_VICTIM_SIZE > 0 ? HOSTTLB_VICTIM_SIZE : 1)
+
+// Entries are tagged with the id of the translation context (address space
+// and privilege) they were filled in. The id lives in the page offset bits
+// of the tag, so the fast path still needs a single compare, and switching
+// the context only changes the tag being matched.
+#define HOSTTLB_CTX_NUM 16
+#define HOSTTLB_CTX_ID_INVALID PAGE_MASK
+#define HOSTTLB_TAG_INVALID ((vaddr_t)-1)
 
 typedef struct {
   uint8_t *offset; // offset from the guest virtual address of the data page to the host virtual address
-  vaddr_t gvpn; // guest virtual page number
+  vaddr_t tag; // guest virtual page address | context id
+#ifdef CONFIG_RV_DASICS
+  // hosttlb_dasics_epoch if the whole page is within dlbounds allowing the
+  // type of access of the TLB, so that untrusted code skips the bound check
+  uint32_t dasics;
+#endif
 } HostTLBEntry;
 
-static HostTLBEntry hosttlb[HOSTTLB_SIZE * 2];
-static HostTLBEntry* const hostrtlb = &hosttlb[0];
-static HostTLBEntry* const hostwtlb = &hosttlb[HOSTTLB_SIZE];
+typedef struct {
+  uint64_t hit;        // hit in the first way
+  uint64_t set_hit;    // hit in other ways of the set
+  uint64_t victim_hit; // hit in the victim buffer
+  uint64_t miss;
+  uint64_t conflict;   // valid entries of the current context evicted from the set
+} HostTLBStat;
+
+typedef struct {
+  word_t asid;
+  word_t root;
+  int priv;
+  vaddr_t id; // 0 means the slot is free
+} HostTLBContext;
+
+typedef struct {
+  // ways of a set are kept in MRU order, the first way is checked by the fast path
+  HostTLBEntry entry[HOSTTLB_SIZE];
+  HostTLBEntry victim[HOSTTLB_VICTIM_ALLOC];
+  int victim_next;
+  HostTLBContext *ctx; // the context entries are currently filled in
+  IFDEF(CONFIG_HOSTTLB_STAT, HostTLBStat stat);
+} HostTLB;
+
+// Data accesses and instruction fetches are translated under different
+// privileges (MPRV, SUM and MXR only apply to data), so they are tracked
+// as two current contexts sharing the same context table.
+static HART_LOCAL HostTLBContext hosttlb_ctx[HOSTTLB_CTX_NUM];
+static HART_LOCAL HostTLBContext hosttlb_dctx_cur = { .id = 1 };
+static HART_LOCAL HostTLBContext hosttlb_ictx_cur = { .id = 2 };
+static HART_LOCAL vaddr_t hosttlb_ctx_next_id = 3;
+static HART_LOCAL int hosttlb_ctx_victim = 0;
+
+// The addresses of thread-local contexts are not constants, so with several
+// harts the TLBs are bound to them in hosttlb_init().
+static HART_LOCAL HostTLB hosttlb[3] = {
+#ifndef CONFIG_MULTIHART
+  [0] = { .ctx = &hosttlb_dctx_cur },
+  [1] = { .ctx = &hosttlb_dctx_cur },
+  [2] = { .ctx = &hosttlb_ictx_cur },
+#endif
+};
+#define hostrtlb (&hosttlb[0])
+#define hostwtlb (&hosttlb[1])
+#define hostitlb (&hosttlb[2])
+
+#ifdef CONFIG_RV_DASICS
+static HART_LOCAL uint32_t hosttlb_dasics_epoch = 1;
+#endif
+
+#ifdef CONFIG_HOSTTLB_STAT
+#define hosttlb_stat(t, event) ((t)->stat.event ++)
+#else
+#define hosttlb_stat(t, event)
+#endif
 
 static inline vaddr_t hosttlb_vpn(vaddr_t vaddr) {
   return (vaddr >> PAGE_SHIFT);
 }
 
-static inline int hosttlb_idx(vaddr_t vaddr) {
-  return (hosttlb_vpn(vaddr) % HOSTTLB_SIZE);
+static inline HostTLBEntry* hosttlb_set(HostTLB *t, vaddr_t vaddr) {
+  return &t->entry[(hosttlb_vpn(vaddr) % HOSTTLB_SETS) * HOSTTLB_WAYS];
+}
+
+static inline vaddr_t hosttlb_tag(HostTLB *t, vaddr_t vaddr) {
+  return (vaddr & ~(vaddr_t)PAGE_MASK) | t->ctx->id;
+}
+
+static inline bool hosttlb_page_match(HostTLBEntry *e, vaddr_t vaddr) {
+  return ((e->tag ^ vaddr) & ~(vaddr_t)PAGE_MASK) == 0;
+}
+
+static void hosttlb_invalidate_all() {
+  for (int i = 0; i < ARRLEN(hosttlb); i ++) {
+    memset(hosttlb[i].entry, -1, sizeof(hosttlb[i].entry));
+    memset(hosttlb[i].victim, -1, sizeof(hosttlb[i].victim));
+  }
+}
+
+static vaddr_t hosttlb_ctx_alloc_id() {
+  if (hosttlb_ctx_next_id == HOSTTLB_CTX_ID_INVALID) {
+    // context ids are used up, really drop all entries and start over
+    hosttlb_invalidate_all();
+    memset(hosttlb_ctx, 0, sizeof(hosttlb_ctx));
+    hosttlb_ctx_next_id = 1;
+  }
+  return hosttlb_ctx_next_id ++;
+}
+
+static inline bool hosttlb_ctx_match(HostTLBContext *c, word_t asid, word_t root, int priv) {
+  return c->id != 0 && c->asid == asid && c->root == root && c->priv == priv;
+}
+
+static HostTLBContext* hosttlb_ctx_insert(word_t asid, word_t root, int priv) {
+  vaddr_t id = hosttlb_ctx_alloc_id();
+  HostTLBContext *c = &hosttlb_ctx[hosttlb_ctx_victim];
+  hosttlb_ctx_victim = (hosttlb_ctx_victim + 1) % HOSTTLB_CTX_NUM;
+  *c = (HostTLBContext) { .asid = asid, .root = root, .priv = priv, .id = id };
+  return c;
+}
+
+// Bind a current context to a fresh id. Entries filled with the old id become unreachable.
+static void hosttlb_ctx_renew(HostTLBContext *cur) {
+  for (int i = 0; i < HOSTTLB_CTX_NUM; i ++) {
+    if (hosttlb_ctx_match(&hosttlb_ctx[i], cur->asid, cur->root, cur->priv)) {
+      hosttlb_ctx[i].id = 0;
+    }
+  }
+  *cur = *hosttlb_ctx_insert(cur->asid, cur->root, cur->priv);
+}
+
+static void hosttlb_ctx_switch(HostTLBContext *cur, word_t asid, word_t root, int priv) {
+  if (cur->asid == asid && cur->root == root && cur->priv == priv) return;
+
+  for (int i = 0; i < HOSTTLB_CTX_NUM; i ++) {
+    if (hosttlb_ctx_match(&hosttlb_ctx[i], asid, root, priv)) {
+      *cur = hosttlb_ctx[i];
+      return;
+    }
+  }
+  *cur = *hosttlb_ctx_insert(asid, root, priv);
+}
+
+// `ifetch_priv` must not collide with any `data_priv`, since both kinds of
+// contexts live in the same table.
+void hosttlb_set_context(word_t asid, word_t root, int data_priv, int ifetch_priv) {
+  hosttlb_ctx_switch(&hosttlb_dctx_cur, asid, root, data_priv);
+  hosttlb_ctx_switch(&hosttlb_ictx_cur, asid, root, ifetch_priv);
+}
+
+static void hosttlb_flush_page(HostTLB *t, vaddr_t vaddr) {
+  HostTLBEntry *set = hosttlb_set(t, vaddr);
+  for (int i = 0; i < HOSTTLB_WAYS; i ++) {
+    if (hosttlb_page_match(&set[i], vaddr)) set[i].tag = HOSTTLB_TAG_INVALID;
+  }
+  for (int i = 0; i < HOSTTLB_VICTIM_SIZE; i ++) {
+    if (hosttlb_page_match(&t->victim[i], vaddr)) t->victim[i].tag = HOSTTLB_TAG_INVALID;
+  }
 }
 
 void hosttlb_flush(vaddr_t vaddr) {
   if (vaddr == 0) {
-    memset(hosttlb, -1, sizeof(hosttlb));
+    memset(hosttlb_ctx, 0, sizeof(hosttlb_ctx));
+    hosttlb_ctx_renew(&hosttlb_dctx_cur);
+    hosttlb_ctx_renew(&hosttlb_ictx_cur);
   } else {
-    vaddr_t gvpn = hosttlb_vpn(vaddr);
-    int idx = hosttlb_idx(vaddr);
-    if (hostrtlb[idx].gvpn == gvpn) hostrtlb[idx].gvpn = (sword_t)-1;
-    if (hostwtlb[idx].gvpn == gvpn) hostwtlb[idx].gvpn = (sword_t)-1;
+    for (int i = 0; i < ARRLEN(hosttlb); i ++) {
+      hosttlb_flush_page(&hosttlb[i], vaddr);
+    }
+  }
+}
+
+#ifdef CONFIG_TCACHE_SMC
+// Drop the write entries mapping the guest physical page of `paddr`, whatever
+// their context is, so that writes to it go through paddr_write().
+void hosttlb_flush_write(paddr_t paddr) {
+  uint8_t *page = guest_to_host(paddr & ~(paddr_t)PAGE_MASK);
+  HostTLBEntry *e[] = { hostwtlb->entry, hostwtlb->victim };
+  int nr[] = { HOSTTLB_SIZE, HOSTTLB_VICTIM_SIZE };
+  for (int i = 0; i < ARRLEN(e); i ++) {
+    for (int j = 0; j < nr[i]; j ++) {
+      vaddr_t tag = e[i][j].tag;
+      if (tag == HOSTTLB_TAG_INVALID) continue;
+      if (e[i][j].offset + (tag & ~(vaddr_t)PAGE_MASK) == page) e[i][j].tag = HOSTTLB_TAG_INVALID;
+    }
+  }
+}
+#endif
+
+// Drop all write entries, so that the next write to each page goes through
+// paddr_write() again.
+void hosttlb_flush_write_all() {
+  memset(hostwtlb->entry, -1, sizeof(hostwtlb->entry));
+  memset(hostwtlb->victim, -1, sizeof(hostwtlb->victim));
+}
+
+void hosttlb_flush_asid(vaddr_t vaddr, word_t asid) {
+  if (vaddr != 0) {
+    // the tag does not record the ASID, conservatively drop the page for all address spaces
+    hosttlb_flush(vaddr);
+    return;
+  }
+  for (int i = 0; i < HOSTTLB_CTX_NUM; i ++) {
+    if (hosttlb_ctx[i].asid == asid) hosttlb_ctx[i].id = 0;
   }
+  if (hosttlb_dctx_cur.asid == asid) hosttlb_ctx_renew(&hosttlb_dctx_cur);
+  if (hosttlb_ictx_cur.asid == asid) hosttlb_ctx_renew(&hosttlb_ictx_cur);
 }
 
 void hosttlb_init() {
+  hostrtlb->ctx = hostwtlb->ctx = &hosttlb_dctx_cur;
+  hostitlb->ctx = &hosttlb_ictx_cur;
+  hosttlb_invalidate_all();
   hosttlb_flush(0);
 }
 
+#ifdef CONFIG_HOSTTLB_STAT
+void hosttlb_statistic() {
+  const char *name[] = { "read", "write", "ifetch" };
+  for (int i = 0; i < ARRLEN(hosttlb); i ++) {
+    HostTLBStat *st = &hosttlb[i].stat;
+    uint64_t total = st->hit + st->set_hit + st->victim_hit + st->miss;
+    Log("host TLB %s: %'ld accesses, hit = %'ld, set hit = %'ld, victim hit = %'ld, miss = %'ld, conflict = %'ld",
+        name[i], total, st->hit, st->set_hit, st->victim_hit, st->miss, st->conflict);
+  }
+}
+#endif
+
+// Move `e` to the first way of the set and return the entry pushed out of `way`.
+static inline HostTLBEntry hosttlb_set_push(HostTLBEntry *set, int way, HostTLBEntry e) {
+  HostTLBEntry out = set[way];
+  for (int i = way; i > 0; i --) set[i] = set[i - 1];
+  set[0] = e;
+  return out;
+}
+
+// Look for the entry in other ways of the set and the victim buffer.
+// On success the entry is promoted to the first way of the set.
+static HostTLBEntry* hosttlb_lookup_slow(HostTLB *t, vaddr_t vaddr) {
+  vaddr_t tag = hosttlb_tag(t, vaddr);
+  HostTLBEntry *set = hosttlb_set(t, vaddr);
+  for (int i = 1; i < HOSTTLB_WAYS; i ++) {
+    if (set[i].tag == tag) {
+      hosttlb_stat(t, set_hit);
+      hosttlb_set_push(set, i, set[i]);
+      return &set[0];
+    }
+  }
+  for (int i = 0; i < HOSTTLB_VICTIM_SIZE; i ++) {
+    if (t->victim[i].tag == tag) {
+      hosttlb_stat(t, victim_hit);
+      t->victim[i] = hosttlb_set_push(set, HOSTTLB_WAYS - 1, t->victim[i]);
+      return &set[0];
+    }
+  }
+  hosttlb_stat(t, miss);
+  return NULL;
+}
+
+// The host address of `paddr` if data accesses to it may hit in the host TLB.
+static inline uint8_t* hosttlb_data_host_addr(paddr_t paddr) {
+  if (likely(in_pmem(paddr))) return guest_to_host(paddr);
+#if defined(CONFIG_DEVICE) && !defined(CONFIG_DIFFTEST)
+  // difftest still has to skip accesses to device memory
+  uint8_t *page = mmio_plain_page(paddr);
+  if (page != NULL) return page + (paddr & PAGE_MASK);
+#endif
+  return NULL;
+}
+
+static HostTLBEntry* hosttlb_fill(HostTLB *t, vaddr_t vaddr, uint8_t *haddr) {
+  HostTLBEntry e = { .offset = haddr - vaddr, .tag = hosttlb_tag(t, vaddr) };
+  HostTLBEntry *set = hosttlb_set(t, vaddr);
+  HostTLBEntry out = hosttlb_set_push(set, HOSTTLB_WAYS - 1, e);
+  if (out.tag == HOSTTLB_TAG_INVALID) return set;
+  if ((out.tag & PAGE_MASK) == t->ctx->id) hosttlb_stat(t, conflict);
+  if (HOSTTLB_VICTIM_SIZE > 0) {
+    t->victim[t->victim_next] = out;
+    t->victim_next = (t->victim_next + 1) % HOSTTLB_VICTIM_ALLOC;
+  }
+  return set;
+}
+
+#ifdef CONFIG_RV_DASICS
+bool dasics_match_dlib_page(vaddr_t vaddr, int type);
+
+static inline void hosttlb_dasics_fill(HostTLBEntry *e, vaddr_t vaddr, int type) {
+  e->dasics = dasics_match_dlib_page(vaddr, type) ? hosttlb_dasics_epoch : 0;
+}
+
+// Whether the access is known to be within dlbounds from the entry mapping
+// its page. Only the first way is checked, others go through the bound check.
+bool hosttlb_dasics_allowed(vaddr_t vaddr, int len, int type) {
+  HostTLB *t = (type == MEM_TYPE_WRITE ? hostwtlb : hostrtlb);
+  HostTLBEntry *e = hosttlb_set(t, vaddr);
+  return e->tag == hosttlb_tag(t, vaddr) && e->dasics == hosttlb_dasics_epoch &&
+    (vaddr & PAGE_MASK) + len <= PAGE_SIZE;
+}
+
+// Called when dlbounds change, entries filled before do not allow anything.
+void hosttlb_dasics_flush() {
+  hosttlb_dasics_epoch ++;
+  if (hosttlb_dasics_epoch == 0) {
+    for (int i = 0; i < ARRLEN(hosttlb); i ++) {
+      for (int j = 0; j < HOSTTLB_SIZE; j ++) hosttlb[i].entry[j].dasics = 0;
+      for (int j = 0; j < HOSTTLB_VICTIM_SIZE; j ++) hosttlb[i].victim[j].dasics = 0;
+    }
+    hosttlb_dasics_epoch = 1;
+  }
+}
+#endif
+
 static paddr_t va2pa(struct Decode *s, vaddr_t vaddr, int len, int type) {
   if (type != MEM_TYPE_IFETCH) save_globals(s);
   int ret = isa_mmu_check(vaddr, len, type);
@@ -67,11 +350,13 @@ static paddr_t va2pa(struct Decode *s, vaddr_t vaddr, int len, int type) {
 
 __attribute__((noinline))
 static word_t hosttlb_read_slowpath(struct Decode *s, vaddr_t vaddr, int len, int type) {
+  HostTLBEntry *e = hosttlb_lookup_slow(hostrtlb, vaddr);
+  if (e != NULL) return host_read(e->offset + vaddr, len);
   paddr_t paddr = va2pa(s, vaddr, len, type);
-  if (likely(in_pmem(paddr))) {
-    HostTLBEntry *e = &hostrtlb[hosttlb_idx(vaddr)];
-    e->offset = guest_to_host(paddr) - vaddr;
-    e->gvpn = hosttlb_vpn(vaddr);
+  uint8_t *haddr = hosttlb_data_host_addr(paddr);
+  if (likely(haddr != NULL)) {
+    e = hosttlb_fill(hostrtlb, vaddr, haddr);
+    IFDEF(CONFIG_RV_DASICS, hosttlb_dasics_fill(e, vaddr, MEM_TYPE_READ));
   }
   Logtr("Slowpath, vaddr " FMT_WORD " --> paddr: " FMT_PADDR, vaddr, paddr);
   return paddr_read(paddr, len, MEM_TYPE_READ, MODE_S, vaddr);
@@ -79,34 +364,96 @@ static word_t hosttlb_read_slowpath(struct Decode *s, vaddr_t vaddr, int len, in
 
 __attribute__((noinline))
 static void hosttlb_write_slowpath(struct Decode *s, vaddr_t vaddr, int len, word_t data) {
+  HostTLBEntry *e = hosttlb_lookup_slow(hostwtlb, vaddr);
+  if (e != NULL) {
+    host_write(e->offset + vaddr, len, data);
+    return;
+  }
   paddr_t paddr = va2pa(s, vaddr, len, MEM_TYPE_WRITE);
-  if (likely(in_pmem(paddr))) {
-    HostTLBEntry *e = &hostwtlb[hosttlb_idx(vaddr)];
-    e->offset = guest_to_host(paddr) - vaddr;
-    e->gvpn = hosttlb_vpn(vaddr);
+  uint8_t *haddr = hosttlb_data_host_addr(paddr);
+  // writes to code pages are checked for self-modifying code
+  if (likely(haddr != NULL) &&
+      MUXDEF(CONFIG_TCACHE_SMC, (!in_pmem(paddr) || pmem_code_map_write(paddr)), true)) {
+    e = hosttlb_fill(hostwtlb, vaddr, haddr);
+    IFDEF(CONFIG_RV_DASICS, hosttlb_dasics_fill(e, vaddr, MEM_TYPE_WRITE));
   }
   paddr_write(paddr, len, data, MODE_S, vaddr);
 }
 
+__attribute__((noinline))
+static word_t hosttlb_ifetch_slowpath(vaddr_t vaddr, int len) {
+  HostTLBEntry *e = hosttlb_lookup_slow(hostitlb, vaddr);
+  if (e != NULL) return host_read(e->offset + vaddr, len);
+  paddr_t paddr = va2pa(NULL, vaddr, len, MEM_TYPE_IFETCH);
+  word_t data = paddr_read(paddr, len, MEM_TYPE_IFETCH, cpu.mode, vaddr);
+  // hits skip the PMP check, so only cache pages which are executable as a whole
+  if (likely(in_pmem(paddr)) &&
+      isa_pmp_check_permission(paddr & ~(paddr_t)PAGE_MASK, PAGE_SIZE, MEM_TYPE_IFETCH, cpu.mode)) {
+    hosttlb_fill(hostitlb, vaddr, guest_to_host(paddr));
+  }
+  Logtr("Ifetch slowpath, vaddr " FMT_WORD " --> paddr: " FMT_PADDR, vaddr, paddr);
+  return data;
+}
+
+// Untranslated fetches are cached as well, the context already tells
+// whether translation is enabled.
+word_t hosttlb_ifetch(vaddr_t vaddr, int len) {
+  HostTLBEntry *e = hosttlb_set(hostitlb, vaddr);
+  if (unlikely(e->tag != hosttlb_tag(hostitlb, vaddr))) {
+    return hosttlb_ifetch_slowpath(vaddr, len);
+  }
+  hosttlb_stat(hostitlb, hit);
+  return host_read(e->offset + vaddr, len);
+}
+
+#ifdef CONFIG_TCACHE_SMC
+// The physical address of an instruction which has just been fetched.
+paddr_t hosttlb_ifetch_paddr(vaddr_t vaddr) {
+  HostTLBEntry *e = hosttlb_set(hostitlb, vaddr);
+  if (likely(e->tag == hosttlb_tag(hostitlb, vaddr))) return host_to_guest(e->offset + vaddr);
+  return va2pa(NULL, vaddr, 1, MEM_TYPE_IFETCH);
+}
+#endif
+
+#ifdef CONFIG_MULTIHART
+// The host address of the guest data at `vaddr` for an atomic instruction,
+// which is translated and checked as a write. NULL is returned if it is not
+// in pmem, and the caller falls back to ordinary loads and stores. A hit is
+// checked too, since the entry may map a plain MMIO page, see
+// hosttlb_data_host_addr().
+void* hosttlb_atomic_addr(struct Decode *s, vaddr_t vaddr, int len) {
+  HostTLBEntry *e = hosttlb_set(hostwtlb, vaddr);
+  if (unlikely(e->tag != hosttlb_tag(hostwtlb, vaddr))) e = hosttlb_lookup_slow(hostwtlb, vaddr);
+  if (e != NULL) {
+    uint8_t *haddr = e->offset + vaddr;
+    return in_pmem(host_to_guest(haddr)) ? haddr : NULL;
+  }
+  paddr_t paddr = va2pa(s, vaddr, len, MEM_TYPE_WRITE);
+  if (!in_pmem(paddr)) return NULL;
+  hosttlb_fill(hostwtlb, vaddr, guest_to_host(paddr));
+  return guest_to_host(paddr);
+}
+#endif
+
 word_t hosttlb_read(struct Decode *s, vaddr_t vaddr, int len, int type) {
   Logm("hosttlb_reading " FMT_WORD, vaddr);
-  vaddr_t gvpn = hosttlb_vpn(vaddr);
-  HostTLBEntry *e = &hostrtlb[hosttlb_idx(vaddr)];
-  if (unlikely(e->gvpn != gvpn)) {
+  HostTLBEntry *e = hosttlb_set(hostrtlb, vaddr);
+  if (unlikely(e->tag != hosttlb_tag(hostrtlb, vaddr))) {
     Logm("Host TLB slow path");
     return hosttlb_read_slowpath(s, vaddr, len, type);
   } else {
     Logm("Host TLB fast path");
+    hosttlb_stat(hostrtlb, hit);
     return host_read(e->offset + vaddr, len);
   }
 }
 
 void hosttlb_write(struct Decode *s, vaddr_t vaddr, int len, word_t data) {
-  vaddr_t gvpn = hosttlb_vpn(vaddr);
-  HostTLBEntry *e = &hostwtlb[hosttlb_idx(vaddr)];
-  if (unlikely(e->gvpn != gvpn)) {
+  HostTLBEntry *e = hosttlb_set(hostwtlb, vaddr);
+  if (unlikely(e->tag != hosttlb_tag(hostwtlb, vaddr))) {
     hosttlb_write_slowpath(s, vaddr, len, data);
     return;
   }
+  hosttlb_stat(hostwtlb, hit);
   host_write(e->offset + vaddr, len, data);
 }
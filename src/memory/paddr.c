@@ -17,6 +17,8 @@
 #include <isa.h>
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/host-tlb.h>
 #include <device/mmio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -48,7 +50,118 @@ static inline word_t pmem_read(paddr_t addr, int len) {
   return host_read(guest_to_host(addr), len);
 }
 
+#ifdef CONFIG_TCACHE_SMC
+// One bit for each page of pmem. A page is marked as code once instructions
+// on it are decoded, and as dirty when it is written after that. Writes to
+// code pages never hit in the host TLB, so they are all seen here.
+static uint64_t *code_bitmap = NULL, *dirty_bitmap = NULL;
+static uint64_t *wmap_bitmap = NULL; // pages which may be mapped by the host TLB for writing
+static size_t bitmap_size = 0;
+static int nr_dirty = 0;
+
+static inline uint64_t pmem_page_idx(paddr_t addr) {
+  return (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+}
+
+static inline bool bitmap_test(uint64_t *bitmap, uint64_t idx) {
+  return (bitmap[idx / 64] >> (idx % 64)) & 1;
+}
+
+static void pmem_code_init() {
+  bitmap_size = ((MEMORY_SIZE >> PAGE_SHIFT) + 63) / 64 * sizeof(uint64_t);
+  code_bitmap = calloc(1, bitmap_size);
+  dirty_bitmap = calloc(1, bitmap_size);
+  wmap_bitmap = calloc(1, bitmap_size);
+  assert(code_bitmap != NULL && dirty_bitmap != NULL && wmap_bitmap != NULL);
+}
+
+// Called before the host TLB maps the page of `addr` for writing, which is
+// refused for code pages.
+bool pmem_code_map_write(paddr_t addr) {
+  uint64_t idx = pmem_page_idx(addr);
+  if (bitmap_test(code_bitmap, idx)) return false;
+  wmap_bitmap[idx / 64] |= 1ull << (idx % 64);
+  return true;
+}
+
+void pmem_code_mark(paddr_t addr) {
+  if (!in_pmem(addr)) return;
+  uint64_t idx = pmem_page_idx(addr);
+  if (bitmap_test(code_bitmap, idx)) return;
+  code_bitmap[idx / 64] |= 1ull << (idx % 64);
+  if (bitmap_test(wmap_bitmap, idx)) {
+    wmap_bitmap[idx / 64] &= ~(1ull << (idx % 64));
+    hosttlb_flush_write(addr);
+  }
+}
+
+static void pmem_code_page_write(uint64_t idx) {
+  if (!bitmap_test(code_bitmap, idx)) return;
+  code_bitmap[idx / 64] &= ~(1ull << (idx % 64));
+  if (!bitmap_test(dirty_bitmap, idx)) {
+    dirty_bitmap[idx / 64] |= 1ull << (idx % 64);
+    nr_dirty ++;
+  }
+}
+
+void pmem_code_write(paddr_t addr, size_t len) {
+  if (len == 0 || !in_pmem(addr)) return;
+  uint64_t last = pmem_page_idx(addr + len - 1);
+  for (uint64_t idx = pmem_page_idx(addr); idx <= last; idx ++) {
+    pmem_code_page_write(idx);
+  }
+}
+
+bool pmem_code_dirty(paddr_t addr) {
+  return nr_dirty > 0 && in_pmem(addr) && bitmap_test(dirty_bitmap, pmem_page_idx(addr));
+}
+
+bool pmem_code_has_dirty() {
+  return nr_dirty > 0;
+}
+
+void pmem_code_clean() {
+  if (nr_dirty == 0) return;
+  memset(dirty_bitmap, 0, bitmap_size);
+  nr_dirty = 0;
+}
+#endif
+
+// One bit for each page of pmem written since the last checkpoint, only
+// allocated when taking delta checkpoints. Writes hitting in the host TLB
+// are not seen here, but a page is always written once through the slow
+// path when it is mapped for writing, and the write entries are dropped
+// each time the bitmap is cleaned.
+static uint64_t *cpt_dirty_bitmap = NULL;
+static size_t cpt_dirty_bitmap_size = 0;
+
+void pmem_dirty_init() {
+  cpt_dirty_bitmap_size = ((MEMORY_SIZE >> PAGE_SHIFT) + 63) / 64 * sizeof(uint64_t);
+  cpt_dirty_bitmap = calloc(1, cpt_dirty_bitmap_size);
+  assert(cpt_dirty_bitmap != NULL);
+}
+
+void pmem_dirty_write(paddr_t addr, size_t len) {
+  if (cpt_dirty_bitmap == NULL || len == 0 || !in_pmem(addr)) return;
+  uint64_t last = (addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT;
+  for (uint64_t idx = (addr - CONFIG_MBASE) >> PAGE_SHIFT; idx <= last; idx ++) {
+    cpt_dirty_bitmap[idx / 64] |= 1ull << (idx % 64);
+  }
+}
+
+const uint64_t* pmem_dirty_bitmap() {
+  return cpt_dirty_bitmap;
+}
+
+void pmem_dirty_clean() {
+  if (cpt_dirty_bitmap == NULL) return;
+  memset(cpt_dirty_bitmap, 0, cpt_dirty_bitmap_size);
+  hosttlb_flush_write_all();
+}
+
 static inline void pmem_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_TCACHE_SMC, pmem_code_write(addr, len));
+  if (unlikely(cpt_dirty_bitmap != NULL)) pmem_dirty_write(addr, len);
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
   store_commit_queue_push(addr, data, len);
 #endif
@@ -83,6 +196,8 @@ void init_mem() {
   }
 #endif
 
+  IFDEF(CONFIG_TCACHE_SMC, pmem_code_init());
+
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
   for (int i = 0; i < STORE_QUEUE_SIZE; i++) {
     store_commit_queue[i].valid = 0;
@@ -113,9 +113,9 @@ static inline word_t vaddr_read_internal(void *s, vaddr_t addr, int len, int typ
   }
 #endif
 #ifdef CONFIG_RV_DASICS
-  void dasics_ldst_helper(vaddr_t pc, vaddr_t vaddr, int len, int type);
+  void dasics_ldst_helper(struct Decode *s, vaddr_t vaddr, int len, int type);
   if (s != NULL) {
-    dasics_ldst_helper(((struct Decode *)s)->pc, addr, len, type);    
+    dasics_ldst_helper(s, addr, len, type);
   }
 #endif  // CONFIG_RV_DASICS
   if (unlikely(mmu_mode == MMU_DYNAMIC)) {
@@ -134,6 +134,9 @@ static inline word_t vaddr_read_internal(void *s, vaddr_t addr, int len, int typ
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
   Logm("Fetching vaddr %lx", addr);
+#ifdef ENABLE_HOSTTLB
+  return hosttlb_ifetch(addr, len);
+#endif
   return vaddr_read_internal(NULL, addr, len, MEM_TYPE_IFETCH, MMU_DYNAMIC);
 }
 
@@ -150,8 +153,8 @@ void vaddr_write(struct Decode *s, vaddr_t addr, int len, word_t data, int mmu_m
   isa_misalign_data_addr_check(addr, len, MEM_TYPE_WRITE);
 #endif
 #ifdef CONFIG_RV_DASICS
-  void dasics_ldst_helper(vaddr_t pc, vaddr_t vaddr, int len, int type);
-  dasics_ldst_helper(s->pc, addr, len, MEM_TYPE_WRITE);
+  void dasics_ldst_helper(struct Decode *s, vaddr_t vaddr, int len, int type);
+  dasics_ldst_helper(s, addr, len, MEM_TYPE_WRITE);
 #endif  // CONFIG_RV_DASICS
   if (unlikely(mmu_mode == MMU_DYNAMIC)) mmu_mode = isa_mmu_check(addr, len, MEM_TYPE_WRITE);
   if (mmu_mode == MMU_DIRECT) { paddr_write(addr, len, data, cpu.mode, addr); return; }
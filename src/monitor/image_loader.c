@@ -17,6 +17,11 @@
 #include <stdlib.h>
 #include <macro.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <checkpoint/sparse.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #ifdef CONFIG_MEM_COMPRESS
 #include <zlib.h>
 #endif
@@ -60,6 +65,83 @@ long load_gz_img(const char *filename) {
 }
 #endif //  CONFIG_MEM_COMPRESS
 
+// Stored pages are page-aligned in the file, so with CONFIG_USE_MMAP each
+// run of them is mapped copy-on-write over pmem, and only faulted in when
+// the guest touches it. Startup then does not depend on the size of the
+// checkpoint. Every run takes a mapping, so past SPARSE_MAX_MAPPINGS of
+// them, and without CONFIG_USE_MMAP, the pages are read into pmem instead.
+// The zero pages in between are dropped with madvise(), which is much
+// cheaper than clearing them since most of them have never been touched.
+// A delta checkpoint is applied on top of its parent, which is loaded first.
+#define SPARSE_MAX_MAPPINGS 4096
+static int nr_sparse_mapping = 0;
+
+long load_sparse_img(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", filename);
+
+  SparseCptHeader hdr;
+  Assert(pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr), "Can not read the header of '%s'", filename);
+  bool delta = hdr.magic == SPARSE_DELTA_MAGIC;
+  Assert(hdr.magic == SPARSE_CPT_MAGIC || delta, "'%s' is not a sparse checkpoint", filename);
+  Assert(hdr.page_size == PAGE_SIZE, "Page size of '%s' is %ld", filename, hdr.page_size);
+  Assert(hdr.nr_page * PAGE_SIZE <= MEMORY_SIZE, "'%s' is larger than pmem", filename);
+
+  size_t bitmap_size = (hdr.nr_page + 63) / 64 * sizeof(uint64_t);
+  uint64_t *bitmap = malloc(bitmap_size);
+  Assert(pread(fd, bitmap, bitmap_size, sizeof(hdr)) == bitmap_size,
+      "Can not read the bitmap of '%s'", filename);
+#define page_present(i) ((bitmap[(i) / 64] >> ((i) % 64)) & 1)
+
+  if (delta) {
+    size_t parent_size = hdr.data_offset - sizeof(hdr) - bitmap_size;
+    char *parent = malloc(parent_size);
+    Assert(pread(fd, parent, parent_size, sizeof(hdr) + bitmap_size) == parent_size,
+        "Can not read the parent of '%s'", filename);
+    Assert(memchr(parent, '\0', parent_size) != NULL, "Bad parent of '%s'", filename);
+    Log("Loading parent %s of delta checkpoint %s", parent, filename);
+    load_sparse_img(parent);
+    free(parent);
+  }
+
+  uint8_t *pmem_start = (uint8_t *)guest_to_host(RESET_VECTOR);
+  off_t offset = hdr.data_offset;
+  uint64_t i = 0;
+  while (i < hdr.nr_page) {
+    uint64_t j = i;
+    bool present = page_present(i);
+    while (j < hdr.nr_page && page_present(j) == present) j ++;
+    uint8_t *start = pmem_start + i * PAGE_SIZE;
+    size_t len = (j - i) * PAGE_SIZE;
+    bool mapped = false;
+#ifdef CONFIG_USE_MMAP
+    if (present && nr_sparse_mapping < SPARSE_MAX_MAPPINGS) {
+      mapped = mmap(start, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+          fd, offset) != MAP_FAILED;
+      nr_sparse_mapping += mapped;
+    }
+#endif
+    if (present && !mapped) {
+      for (size_t done = 0; done < len; ) {
+        ssize_t ret = pread(fd, start + done, len - done, offset + done);
+        Assert(ret > 0, "Can not read pages of '%s'", filename);
+        done += ret;
+      }
+    } else if (!present && !delta && madvise(start, len, MADV_DONTNEED) != 0) {
+      memset(start, 0, len);
+    }
+    if (present) offset += len;
+    i = j;
+  }
+#undef page_present
+
+  Log("Loaded %ld %s pages of %ld from sparse checkpoint, %d runs of pages mapped so far",
+      hdr.nr_present, delta ? "changed" : "non-zero", hdr.nr_page, nr_sparse_mapping);
+  free(bitmap);
+  close(fd);
+  return hdr.nr_page * PAGE_SIZE;
+}
+
 // Return whether a file is a gz file, determined by its name.
 // If the filename ends with ".gz", we treat it as a gz file.
 
@@ -72,6 +154,11 @@ long load_img(char* img_name, char *which_img, uint64_t load_start, size_t img_s
     return 4096; // built-in image size
   }
 
+  if (is_sparse_file(loading_img)) {
+    Log("Loading sparse image %s", loading_img);
+    return load_sparse_img(loading_img);
+  }
+
   if (is_gz_file(loading_img)) {
 #ifdef CONFIG_MEM_COMPRESS
       Log("Loading GZ image %s", loading_img);
@@ -74,9 +74,15 @@ static inline int parse_args(int argc, char *argv[]) {
     {"uniform-cpt"        , no_argument      , NULL, 'u'},
     {"cpt-interval"       , required_argument, NULL, 5},
     {"cpt-mmode"          , no_argument      , NULL, 7},
+    {"cpt-jobs"           , required_argument, NULL, 8},
+    {"cpt-threads"        , required_argument, NULL, 9},
+    {"cpt-level"          , required_argument, NULL, 10},
+    {"cpt-sparse"         , no_argument      , NULL, 11},
+    {"cpt-delta"          , required_argument, NULL, 12},
 
     // profiling
     {"simpoint-profile"   , no_argument      , NULL, 3},
+    {"simpoint-bin"       , no_argument      , NULL, 13},
     {"dont-skip-boot"     , no_argument      , NULL, 6},
 
     // restore cpt
@@ -138,6 +144,31 @@ static inline int parse_args(int argc, char *argv[]) {
         force_cpt_mmode = true;
         break;
 
+      case 8:
+        sscanf(optarg, "%d", &checkpoint_jobs);
+        Assert(checkpoint_jobs >= 0, "The number of checkpoint jobs should not be negative");
+        break;
+
+      case 9:
+        sscanf(optarg, "%d", &checkpoint_threads);
+        Assert(checkpoint_threads >= 1, "The number of compression threads should be positive");
+        break;
+
+      case 10:
+        sscanf(optarg, "%d", &checkpoint_level);
+        Assert(checkpoint_level >= 0 && checkpoint_level <= 9, "The compression level should be in [0, 9]");
+        break;
+
+      case 11: checkpoint_sparse = true; break;
+
+      case 12:
+        sscanf(optarg, "%d", &checkpoint_delta);
+        Assert(checkpoint_delta >= 1, "The number of checkpoints sharing a base should be positive");
+        checkpoint_sparse = true;
+        break;
+
+      case 13: simpoint_binary = true; break;
+
       case 4: sscanf(optarg, "%d", &cpt_id); break;
 
       default:
@@ -159,8 +190,15 @@ static inline int parse_args(int argc, char *argv[]) {
         printf("\t-u,--uniform-cpt        uniformly take cpt with fixed interval\n");
         printf("\t--cpt-interval=INTERVAL cpt interval: the profiling period for simpoint; the checkpoint interval for uniform cpt\n");
         printf("\t--cpt-mmode             force to take cpt in mmode, which might not work.\n");
+        printf("\t--cpt-jobs=N            serialize up to N cpts at once in forked processes\n");
+        printf("\t--cpt-threads=N         compress each cpt with N threads\n");
+        printf("\t--cpt-level=L           gzip compression level of cpts, 0-9\n");
+        printf("\t--cpt-sparse            store only non-zero pages of cpts uncompressed, as *.sparse\n");
+        printf("\t--cpt-delta=N           take a full sparse cpt every N cpts, and only store the pages\n");
+        printf("\t                        written since the previous cpt for the others\n");
 
         printf("\t--simpoint-profile      simpoint profiling\n");
+        printf("\t--simpoint-bin          write the simpoint bbv in binary, see scripts/bbv2text.py\n");
         printf("\t--dont-skip-boot        profiling/checkpoint immediately after boot\n");
         printf("\t--cpt-id                checkpoint id\n");
         printf("\n");
@@ -186,6 +224,11 @@ void init_monitor(int argc, char *argv[]) {
   extern void unserialize();
 
   bool output_features_enabled = checkpoint_taking || profiling_state == SimpointProfiling;
+#ifdef CONFIG_MULTIHART
+  if (output_features_enabled || checkpoint_restoring) {
+    panic("SimPoint profiling and checkpoints are not supported with several harts");
+  }
+#endif
   if (output_features_enabled) {
     init_path_manager();
     simpoint_init();
@@ -20,4 +20,11 @@ bool is_gz_file(const char *filename) {
     return false;
   }
   return !strcmp(filename + (strlen(filename) - 3), ".gz");
+}
+
+bool is_sparse_file(const char *filename) {
+  if (filename == NULL || strlen(filename) < 7) {
+    return false;
+  }
+  return !strcmp(filename + (strlen(filename) - 7), ".sparse");
 }
\ No newline at end of file
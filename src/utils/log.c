@@ -29,7 +29,7 @@ void init_log(const char *log_file) {
 }
 
 bool log_enable() {
-  extern uint64_t g_nr_guest_instr;
+  extern HART_LOCAL uint64_t g_nr_guest_instr;
   return (g_nr_guest_instr >= LOG_START) && (g_nr_guest_instr <= LOG_END);
 }
 